@@ -3,12 +3,18 @@
 
 #pragma once
 #include <algorithm>
-#include <map>
+#include <array>
 #include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <functional>
 #include <memory>
+#include <numeric>
 #include <optional>
-#include <set>
-#include <map>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
 #include <algorithm>
 #include "neighborhood.h"
 #include "vec.h"
@@ -16,38 +22,126 @@
 #include "cgralgs.h"
 #include "cell.h"
 #include "clr-grain.h"
+#include "small-set.h"
+#include "intern-table.h"
+#include "bucket-grid.h"
+#include "layout.h"
+#include "bit-front.h"
+#include "tile-map.h"
+#include "storage.h"
+#include "checkpoint.h"
 
 
 namespace cgr {
 
-template <std::size_t Dim, typename Real = double>
+// each cell of the grid holds a Label indexing a dense table of interned grain sets,
+// cells are stored in the order of Layout. grains grow by Norm, the default any_norm
+// takes the kind given to spawn_grain(), a concrete norm accepts only its own kind.
+// fronts and cell lists are stored as Offset, stencil shifts as Coord coordinates,
+// narrower types than the defaults halve their memory when the grid fits in them.
+// labels and the other per cell arrays are made by Storage, mapped_storage keeps them
+// in files for grids larger than the memory
+template <std::size_t Dim, typename Real = double, typename Label = std::uint32_t,
+          typename Layout = linear_layout<Dim>, typename Norm = any_norm<Dim, Real>,
+          typename Coord = std::int64_t, typename Offset = std::size_t, typename Storage = vector_storage>
 class automata {
+    static_assert(std::is_unsigned_v<Label>);
+    static_assert(std::is_signed_v<Coord> && std::is_unsigned_v<Offset>);
+
 public:
     static constexpr std::size_t dim = Dim;
+    using label_type = Label;
+    // reserved label of an empty (not crystallized) cell, every interned set is crysted
+    static constexpr label_type null_label = std::numeric_limits<label_type>::max();
     using cell_type = cgr::cell<Dim, Real>;
     using grain_type = typename cell_type::grain_type;
     using grains_container = typename cell_type::grains_container;
     using material_type = typename grain_type::material_type;
     using orientation_type = typename grain_type::orientation_type;
-    using clr_grain_type = clr_grain<Dim, Real>;
+    using layout_type = Layout;
+    using storage_type = Storage;
+    template <typename T>
+    using array_type = typename Storage::template array<T>;
+    using labels_type = array_type<label_type>;
+    using norm_type = Norm;
+    using coord_type = Coord;
+    using offset_type = Offset;
+    using clr_grain_type = clr_grain<Dim, Real, Layout, Norm, Coord, Offset>;
+    using stencil_cache_type = typename clr_grain_type::stencil_cache_type;
     using grow_dir_type = grow_dir_t<Dim, Real>;
+    using grain_index_type = std::uint32_t;
+    // 4 is the geometric limit, overflowed cells must still be representable to be reported
+    static constexpr std::size_t max_cell_grains = 8;
+    using grain_set_type = small_set<grain_index_type, max_cell_grains>;
+    // the geometry takes cells of at most 4 grains, each face of the box a cell lies on
+    // counts as a grain. cells of one grain never overflow
+    static constexpr std::size_t max_cell_order = 4;
+    static_assert(Dim + 1 <= max_cell_order);
+    // a saturated grain set is always an overflowed one
+    static_assert(max_cell_order < max_cell_grains);
+    using overflow_hook_type = std::function<void(const automata&)>;
+    using grain_sets_type = intern_table<grain_set_type, label_type>;
+    using tiles_type = tile_map<Dim, label_type, Dim == 2 ? 3 : 2>;
 
     std::size_t num_crysted_cells() const {
-        std::size_t res = 0;
-        for (std::size_t i = 0; i < num_cells(); ++i)
-            if (cell(i) && cell(i)->crysted)
-                ++res;
-        return res;
+        return num_cells() - m_num_null_cells;
+    }
+    std::size_t num_null_cells() const {
+        return m_num_null_cells;
     }
     std::size_t num_cells() const {
-        return m_cells.size();
+        return m_num_cells;
+    }
+    // cells and padding of the layout, offsets are below it
+    std::size_t num_offsets() const {
+        return m_labels.size();
+    }
+    // the offset is of a cell, padding is never crysted
+    bool valid(std::size_t offset) const {
+        return m_layout.valid(offset);
     }
+    // bytes of the labels in the physical memory
+    std::size_t labels_resident_bytes() const {
+        return m_storage.resident_bytes(m_labels);
+    }
+    // distinct cells indexed by label
     const std::vector<cell_type>& cells() const {
-        return m_cells;
+        return m_unicells;
+    }
+    // indexed by offset, padding included
+    const labels_type& labels() const {
+        return m_labels;
+    }
+    label_type label(std::size_t offset) const {
+        return m_labels[offset];
+    }
+    const grain_set_type& grain_set(label_type lbl) const {
+        return m_grain_sets[lbl];
+    }
+
+    // cells over max_cell_order, kept up to date as cells are committed
+    std::size_t num_overflowed_cells() const {
+        return std::accumulate(m_num_overflowed.begin(), m_num_overflowed.end(), static_cast<std::size_t>(0));
+    }
+    // the ones lying on num_box_faces faces of the box: inside it, on its faces, edges and vertices
+    std::size_t num_overflowed_cells(std::size_t num_box_faces) const {
+        return m_num_overflowed[num_box_faces];
+    }
+    // some cell met more than max_cell_grains grains and kept the smallest of them,
+    // it stays so once set. such a cell is counted as overflowed
+    bool saturated() const {
+        return m_saturated;
+    }
+    // hook(*this) after the cells are committed by iterate(), smooth() and voronoi()
+    // while some of them are overflowed, it may throw to abort a hopeless run.
+    // thin_boundary() calls it once at its end only
+    void set_overflow_hook(overflow_hook_type hook) {
+        m_overflow_hook = std::move(hook);
     }
 
     const cell_type* cell(std::size_t offset) const {
-        return m_cells[offset];
+        label_type lbl = m_labels[offset];
+        return lbl == null_label ? nullptr : &m_unicells[lbl];
     }
     const cell_type* cell(const upos_t<Dim>& pos) const {
         return cell(offset(pos));
@@ -57,27 +151,30 @@ public:
     }
 
     bool inside(const upos_t<Dim>& pos) const {
-        return cgr::inside(pos, m_dim_lens);
+        return cgr::inside(pos, dim_lens());
     }
     bool inside(const pos_t<Dim>& pos) const {
         for (auto& e : pos.x)
             if (e < 0)
                 return false;
-        return cgr::inside(static_cast<upos_t<Dim>>(pos), m_dim_lens);
+        return cgr::inside(static_cast<upos_t<Dim>>(pos), dim_lens());
     }
 
     upos_t<Dim> upos(std::size_t offset) const {
-        return cgr::upos(offset, m_dim_lens);
+        return m_layout.upos(offset);
     }
     std::size_t offset(const upos_t<Dim>& pos) const {
-        return offset(static_cast<pos_t<Dim>>(pos));
+        return m_layout.offset(pos);
     }
     std::size_t offset(const pos_t<Dim>& pos) const {
-        return cgr::offset(pos, m_dim_lens);
+        return m_layout.offset(static_cast<upos_t<Dim>>(pos));
     }
 
     const upos_t<Dim>& dim_lens() const {
-        return m_dim_lens;
+        return m_layout.dim_lens();
+    }
+    const layout_type& layout() const {
+        return m_layout;
     }
     std::size_t range() const {
         return m_range;
@@ -87,123 +184,411 @@ public:
         for (auto& clrg : m_clrgrains)
             clrg.set_range(m_range);
     }
+    front_engine engine() const {
+        return m_engine;
+    }
+    // the bitset engine keeps a bit per cell telling whether it is crysted
+    void set_engine(front_engine engine) {
+        m_engine = engine;
+        if (m_engine != front_engine::bitset) {
+            m_crysted_bits.clear();
+            m_crysted_bits_synced = false;
+        }
+    }
 
+    // empty cells take the nearest nucleus, ties go to the earliest spawned grain.
+    // nuclei are looked up ring by ring in a bucket grid until the lower bound
+    // of the distance to the rest of them exceeds the best one
     template <nbh::nbhood_kind NbhKind>
     void voronoi() {
-        #pragma omp parallel for
-        for (std::int64_t i = 0; i < num_cells(); ++i) {
-            auto pos = static_cast<pos_t<Dim>>(upos(i));
-            const grain_type* closest_gr = nullptr;
-            std::size_t min_dist = std::numeric_limits<std::size_t>::max();
+        m_storage.advise(m_labels, access_pattern::sequential);
+        auto buckets = make_nucleus_buckets();
+        Real min_ratio = min_norm_ratio<NbhKind>();
+        if constexpr (NbhKind == nbh::nbhood_kind::crystallographic) {
+            m_num_null_cells -= voronoi_cryst_runs(buckets, min_ratio);
+            m_crysted_bits_synced = false;
+            m_tiles.mark_all_dirty();
+            check_overflow();
+            return;
+        }
 
-            for (auto& clrg : m_clrgrains) {
-                auto diff = static_cast<pos_t<Dim>>(clrg.center()) - pos;
-                std::size_t dist = std::numeric_limits<std::size_t>::max();
-                if constexpr (NbhKind == nbh::nbhood_kind::crystallographic)
-                    dist = clrg.norm(diff);
-                else if constexpr (NbhKind == nbh::nbhood_kind::euclid)
-                    dist = norm2_euclid(diff);
-                else if constexpr (NbhKind == nbh::nbhood_kind::moore)
-                    dist = norm_taxicab(diff);
-                else 
-                    dist = norm_chebyshev(diff);
+        std::size_t num_filled = 0;
+        #pragma omp parallel for schedule(dynamic, 4096) reduction(+:num_filled)
+        for (std::int64_t i = 0; i < static_cast<std::int64_t>(num_offsets()); ++i) {
+            if (m_labels[i] != null_label || !valid(i))
+                continue;
 
-                if (dist < min_dist) {
-                    min_dist = dist;
-                    closest_gr = clrg.grain();
+            m_labels[i] = m_grain_labels[nearest_nucleus<NbhKind>(buckets, min_ratio, upos(i))];
+            ++num_filled;
+        }
+        m_num_null_cells -= num_filled;
+        m_crysted_bits_synced = false;
+        m_tiles.mark_all_dirty();
+        check_overflow();
+    }
+
+    // approximate voronoi() by jump flooding: log2 of the longest side passes plus one
+    // more with unit step, each cell takes the nearest of the nuclei seen by it and by
+    // its 3^Dim - 1 neighbours at the step distance. with verify cells adjacent to
+    // a cell of other nucleus are rechecked exactly and corrected,
+    // the number of the wrong ones among them is returned
+    template <nbh::nbhood_kind NbhKind>
+    std::size_t voronoi_jfa(bool verify = false) {
+        // voronoi() measures von_neumann by norm_chebyshev
+        static_assert(NbhKind == nbh::nbhood_kind::euclid || NbhKind == nbh::nbhood_kind::von_neumann,
+            "jump flooding supports euclid and chebyshev metrics");
+        m_storage.advise(m_labels, access_pattern::sequential);
+
+        auto sites = m_storage.make(num_offsets(), edt_no_site);
+        for (std::size_t j = m_clrgrains.size(); j-- > 0;)
+            sites[offset(m_clrgrains[j].center())] = static_cast<std::uint32_t>(j);
+        auto next_sites = m_storage.make(num_offsets(), edt_no_site);
+
+        // steps halve from the largest power of two below the longest side, unit step is repeated
+        std::vector<std::size_t> steps;
+        std::size_t max_len = *std::max_element(dim_lens().x.begin(), dim_lens().x.end());
+        std::size_t step = 1;
+        while (2 * step < max_len)
+            step *= 2;
+        for (; step > 0; step /= 2)
+            steps.push_back(step);
+        steps.push_back(1);
+
+        auto shifts = nbh::make_shifts<Dim>(chebyshev_norm<Dim>(), 1);
+        for (auto step : steps) {
+            jfa_pass<NbhKind>(sites, next_sites, shifts, step);
+            sites.swap(next_sites);
+        }
+
+        std::size_t num_wrong = 0;
+        if (verify)
+            num_wrong = jfa_verify<NbhKind>(sites);
+
+        std::size_t num_filled = 0;
+        #pragma omp parallel for reduction(+:num_filled)
+        for (std::int64_t i = 0; i < num_offsets(); ++i) {
+            if (m_labels[i] != null_label || sites[i] == edt_no_site)
+                continue;
+            m_labels[i] = m_grain_labels[sites[i]];
+            ++num_filled;
+        }
+        m_num_null_cells -= num_filled;
+        m_crysted_bits_synced = false;
+        m_tiles.mark_all_dirty();
+        check_overflow();
+
+        return num_wrong;
+    }
+
+    // same partition as voronoi<nbh::nbhood_kind::euclid>() in O(num_cells()) for any number
+    // of nuclei: separable exact distance transform (lower envelopes of parabolas
+    // by Felzenszwalb and Huttenlocher) carrying nearest nucleus along each axis in turn
+    void voronoi_edt() {
+        m_storage.advise(m_labels, access_pattern::sequential);
+        auto sites = m_storage.make(num_offsets(), edt_no_site);
+        for (std::size_t j = m_clrgrains.size(); j-- > 0;)
+            sites[offset(m_clrgrains[j].center())] = static_cast<std::uint32_t>(j);
+
+        for (std::size_t k = 0; k < Dim; ++k) {
+            std::size_t len = dim_lens()[k];
+            std::size_t num_lines = num_cells() / len;
+            #pragma omp parallel
+            {
+                edt_scratch scratch(len);
+                #pragma omp for schedule(dynamic, 64)
+                for (std::int64_t l = 0; l < static_cast<std::int64_t>(num_lines); ++l) {
+                    auto line_pos = line_start(l, k);
+                    if constexpr (Layout::is_linear) {
+                        std::size_t base = offset(line_pos);
+                        std::size_t stride = m_layout.stride(k);
+                        edt_line(sites, line_pos, k, scratch,
+                            [base, stride](std::size_t t) -> std::size_t { return base + t * stride; });
+                    } else {
+                        edt_line(sites, line_pos, k, scratch,
+                            [this, pos = line_pos, k](std::size_t t) mutable -> std::size_t {
+                                pos[k] = t;
+                                return offset(pos);
+                            });
+                    }
                 }
             }
+        }
 
-            if (!m_cells[i]) {
-                m_cells[i] = m_unicells[{ closest_gr }].get();
-            }
+        std::size_t num_filled = 0;
+        #pragma omp parallel for reduction(+:num_filled)
+        for (std::int64_t i = 0; i < static_cast<std::int64_t>(num_offsets()); ++i) {
+            if (m_labels[i] != null_label || sites[i] == edt_no_site)
+                continue;
+            m_labels[i] = m_grain_labels[sites[i]];
+            ++num_filled;
         }
+        m_num_null_cells -= num_filled;
+        m_crysted_bits_synced = false;
+        m_tiles.mark_all_dirty();
+        check_overflow();
     }
 
     bool stop_condition() const {
-        for (std::size_t i = 0; i < num_cells(); ++i)
-            if (!cell(i) || !cell(i)->crysted)
-                return false;
-        return true;
+        return m_num_null_cells == 0;
     }
     bool iterate() {
         if (stop_condition())
             return false;
+        advance_fronts();
+        commit_fronts();
+        thin_fronts();
+        return true;
+    }
+
+    // the phases of iterate(), a subdomain of domain_automata moves the front cells
+    // of the other subdomains between them
+    void advance_fronts() {
+        // fronts are scattered over the grid
+        m_storage.advise(m_labels, access_pattern::random);
+
+        bool bits = m_engine == front_engine::bitset;
+        if (bits)
+            sync_crysted_bits();
 
         #pragma omp parallel for
-        for (std::int64_t i = 0; i < m_clrgrains.size(); ++i)
-            m_clrgrains[i].advance_front(
-                [this](std::size_t off) -> bool { return m_cells[off] && m_cells[off]->crysted; },
-                [this](std::size_t off) -> std::size_t { return !m_cells[off] ? 0 : m_cells[off]->grains.size(); });
-
-        for (auto& clrg : m_clrgrains) {
-            for (std::size_t off : clrg.front()) {
-                if (!m_cells[off]) {
-                    m_cells[off] = m_unicells[{ clrg.grain() }].get();
-                } else {
-                    std::set<const grain_type*> grs(m_cells[off]->grains.begin(), m_cells[off]->grains.end());
-                    grs.insert(clrg.grain());
-                    auto pcell = std::make_unique<cell_type>(nullptr, true);
-                    pcell->grains.assign(m_cells[off]->grains.begin(), m_cells[off]->grains.end());
-                    pcell->grains.push_back(clrg.grain());
-                    auto [it, success] = m_unicells.insert({ grs, std::move(pcell) });
-                    m_cells[off] = it->second.get();
+        for (std::int64_t i = 0; i < static_cast<std::int64_t>(m_clrgrains.size()); ++i) {
+            auto numgrs = [this](std::size_t off) -> std::size_t { return num_grains(off); };
+            auto crystedfn = [this](std::size_t off) -> bool { return crysted(off); };
+            if (bits && m_clrgrains[i].dilatable())
+                m_clrgrains[i].advance_front_bits(m_crysted_bits, numgrs);
+            else if (m_engine == front_engine::shell)
+                m_clrgrains[i].advance_front_shells(crystedfn, numgrs);
+            else
+                m_clrgrains[i].advance_front(crystedfn, numgrs);
+        }
+    }
+    // fronts are sorted, each chunk of the grid takes the claims falling into it
+    // from the active grains whose fronts span it. a claim of an empty cell is written in place,
+    // the rest are merged afterwards in chunk then grain order, so every cell ends up
+    // with the union of its claimants. tiles under the front bboxes get dirty
+    void commit_fronts() {
+        bool track_bits = m_crysted_bits_synced;
+        std::size_t num_chunks = this->num_chunks();
+        std::size_t chunk_size = (num_offsets() + num_chunks - 1) / num_chunks;
+        std::vector<std::vector<std::pair<std::size_t, std::size_t>>> conflicts(num_chunks);
+
+        std::vector<std::vector<std::size_t>> chunk_grains(num_chunks);
+        for (std::size_t i = 0; i < m_clrgrains.size(); ++i) {
+            auto& clrgr = m_clrgrains[i];
+            if (!clrgr.active())
+                continue;
+            for (std::size_t c = clrgr.front().front() / chunk_size; c <= clrgr.front().back() / chunk_size; ++c)
+                chunk_grains[c].push_back(i);
+            m_tiles.mark_dirty(clrgr.front_min_corner(), clrgr.front_max_corner());
+        }
+
+        std::size_t num_filled = 0;
+        #pragma omp parallel for schedule(dynamic) reduction(+:num_filled)
+        for (std::int64_t c = 0; c < static_cast<std::int64_t>(num_chunks); ++c) {
+            std::size_t beg = c * chunk_size;
+            std::size_t end = std::min(beg + chunk_size, num_offsets());
+            for (std::size_t i : chunk_grains[c]) {
+                auto& front = m_clrgrains[i].front();
+                auto it = std::lower_bound(front.begin(), front.end(), beg);
+                for (; it != front.end() && *it < end; ++it) {
+                    if (m_labels[*it] == null_label) {
+                        m_labels[*it] = m_grain_labels[i];
+                        ++num_filled;
+                        if (track_bits)
+                            m_crysted_bits.set_atomic(grid_index(*it));
+                    } else {
+                        conflicts[c].push_back({ *it, i });
+                    }
                 }
             }
         }
+        m_num_null_cells -= num_filled;
 
-        for (auto& clrg : m_clrgrains)
-            clrg.thin_front(
-                [this](std::size_t off, const grain_type* gr) -> bool {
-                    return m_cells[off] && m_cells[off]->grains.front() == gr && m_cells[off]->grains.size() == 1;
+        for (auto& chunk_conflicts : conflicts) {
+            for (auto [off, i] : chunk_conflicts) {
+                auto grs = m_grain_sets[m_labels[off]];
+                std::size_t old_size = grs.size();
+                bool inserted = grs.insert(m_grain_idxs[i]);
+                m_saturated |= grs.saturated();
+                if (inserted) {
+                    count_overflow(off, old_size, -1);
+                    count_overflow(off, grs.size(), 1);
+                    m_labels[off] = intern(grs);
+                }
+            }
+        }
+        check_overflow();
+    }
+    void thin_fronts() {
+        #pragma omp parallel for
+        for (std::int64_t i = 0; i < static_cast<std::int64_t>(m_clrgrains.size()); ++i)
+            m_clrgrains[i].thin_front(
+                [this, gr = m_grain_idxs[i]](std::size_t off, const grain_type*) -> bool {
+                    return is_inner(off, gr);
                 });
+    }
 
-        return true;
+    // in spawn order
+    const std::vector<clr_grain_type>& clr_grains() const {
+        return m_clrgrains;
+    }
+    // index of the grain of the i-th clr_grain, grain sets hold such indices
+    grain_index_type grain_index(std::size_t i) const {
+        return m_grain_idxs[i];
+    }
+    // removes the front cells of the i-th clr_grain for which pred(off) holds
+    template <typename Pred>
+    void remove_front_cells(std::size_t i, Pred pred) {
+        auto front = m_clrgrains[i].front();
+        front.erase(std::remove_if(front.begin(), front.end(), pred), front.end());
+        m_clrgrains[i].assign_front(front.begin(), front.end());
+    }
+    // merges the sorted offsets into the front of the i-th clr_grain
+    template <typename OffsetIt>
+    void add_front_cells(std::size_t i, OffsetIt first, OffsetIt last) {
+        if (first == last)
+            return;
+        auto& front = m_clrgrains[i].front();
+        std::vector<offset_type> merged(front.size() + std::distance(first, last));
+        auto end = std::merge(front.begin(), front.end(), first, last, merged.begin());
+        end = std::unique(merged.begin(), end);
+        m_clrgrains[i].assign_front(merged.begin(), end);
+    }
+    // the cell is shared by grs, an empty set empties it
+    void assign_cell(std::size_t off, const grain_set_type& grs) {
+        label_type lbl = grs.empty() ? null_label : intern(grs);
+        if (lbl == m_labels[off])
+            return;
+        count_overflow(off, num_grains(off), -1);
+        count_overflow(off, grs.size(), 1);
+        if (m_labels[off] == null_label)
+            --m_num_null_cells;
+        else if (lbl == null_label)
+            ++m_num_null_cells;
+        m_labels[off] = lbl;
+        m_tiles.mark_dirty(m_tiles.tile_of(upos(off)));
+        if (m_crysted_bits_synced) {
+            if (lbl == null_label)
+                m_crysted_bits_synced = false;
+            else
+                m_crysted_bits.set_atomic(grid_index(off));
+        }
     }
 
     void spawn_grain(const grain_type* grain, const upos_t<Dim>& nucleus_pos, nbh::nbhood_kind kind) {
         spawn_grain(grain, offset(nucleus_pos), kind);
     }
     void spawn_grain(const grain_type* grain, std::size_t nucleus_off, nbh::nbhood_kind kind) {
-        m_clrgrains.emplace_back(grain, kind, m_dim_lens, nucleus_off);
-        m_clrgrains.back().set_range(m_range);
-        auto [it, success] = m_unicells.insert({ std::set{ grain }, std::make_unique<cell_type>(grain, true) });
-        m_cells[nucleus_off] = it->second.get();
+        add_clr_grain(grain, kind, nucleus_off);
+        count_overflow(nucleus_off, num_grains(nucleus_off), -1);
+        if (m_labels[nucleus_off] == null_label)
+            --m_num_null_cells;
+        m_labels[nucleus_off] = m_grain_labels.back();
+        m_crysted_bits_synced = false;
+        m_tiles.mark_dirty(m_tiles.tile_of(upos(nucleus_off)));
+    }
+    // a grain nucleated outside the grid, e.g. in another subdomain. its front is empty
+    // until cells are added by add_front_cells()
+    void spawn_grain(const grain_type* grain, nbh::nbhood_kind kind) {
+        add_clr_grain(grain, kind, 0);
+        m_clrgrains.back().clear_front();
     }
 
+    // every crystallized cell joins the single grain cells within euclid distance rng.
+    // tiles are processed in parallel into a second label buffer, the ones with all the tiles
+    // around holding their single label do not change and are skipped. the stencil is walked
+    // by linear offsets away from the faces in the linear layout and by checked positions otherwise,
+    // grain sets not interned yet are interned afterwards in cell order
     void smooth(std::size_t rng) {
-        auto shs = nbh::make_shifts<Dim>(norm_euclid<Dim>, rng);
-        std::map<std::set<const grain_type*>, std::vector<std::size_t>> grconts;
-        for (std::size_t i = 0; i < num_cells(); ++i) {
-            auto pos = static_cast<pos_t<Dim>>(upos(i));
-            std::vector<pos_t<Dim>> nbs = nbh::apply_shifts(pos, shs, 
-                [this](const pos_t<Dim>& pos) -> bool { return inside(pos); });
-
-            std::set<const grain_type*> grs(m_cells[i]->grains.begin(), m_cells[i]->grains.end());
-            for (auto& nbpos : nbs) {
-                auto& nbgrs = cell(nbpos)->grains;
-                if (nbgrs.size() == 1)
-                    grs.insert(nbgrs.front());
-            }
-            auto [it, success] = grconts.insert({ grs, std::vector<std::size_t>{} });
-            it->second.push_back(i);
-        }
+        auto st = m_stencils->get({ nbh::nbhood_kind::euclid, {}, rng, rng }, euclid_norm<Dim>());
+        auto& shs = st->shifts;
+        auto& deltas = st->deltas;
+        auto new_labels = m_storage.make(num_offsets(), null_label);
+        std::vector<std::pair<std::size_t, grain_set_type>> misses;
+        m_storage.advise(m_labels, access_pattern::sequential);
+        #pragma omp parallel for
+        for (std::int64_t i = 0; i < static_cast<std::int64_t>(num_offsets()); ++i)
+            new_labels[i] = m_labels[i];
 
-        for (auto& p : grconts) {
-            for (std::size_t i : p.second) {
-                std::set<const grain_type*> grs(m_cells[i]->grains.begin(), m_cells[i]->grains.end());
-                if (grs == p.first)
+        refresh_tiles();
+        std::size_t ring = (rng + tiles_type::tile_side - 1) / tiles_type::tile_side;
+        #pragma omp parallel
+        {
+            std::vector<std::pair<std::size_t, grain_set_type>> th_misses;
+            std::array<std::int64_t, Dim + 2> th_overflowed{};
+            // a ball of a large rng may reach more single grain cells than a set holds
+            bool th_saturated = false;
+            #pragma omp for schedule(dynamic)
+            for (std::int64_t t = 0; t < static_cast<std::int64_t>(m_tiles.num_tiles()); ++t) {
+                if (settled_tile(t, ring))
                     continue;
 
-                auto pcell = std::make_unique<cell_type>(nullptr, true);
-                pcell->grains.assign(p.first.begin(), p.first.end());
-                auto [it, success] = m_unicells.insert({ p.first, std::move(pcell) });
-                m_cells[i] = it->second.get();
+                bool tile_changed = false;
+                for_each_tile_cell(t, [&](std::size_t i) {
+                    label_type lbl = m_labels[i];
+                    if (lbl == null_label)
+                        return;
+
+                    auto upos_i = upos(i);
+                    bool interior = Layout::is_linear;
+                    for (std::size_t k = 0; k < Dim; ++k)
+                        interior &= upos_i[k] >= rng && upos_i[k] + rng < dim_lens()[k];
+
+                    auto grs = m_grain_sets[lbl];
+                    bool changed = false;
+                    auto add_nb = [this, &grs, &changed](label_type nblbl) {
+                        if (nblbl != null_label && m_grain_sets[nblbl].size() == 1)
+                            changed |= grs.insert(m_grain_sets[nblbl].front());
+                    };
+                    if (interior) {
+                        for (auto delta : deltas)
+                            add_nb(m_labels[i + delta]);
+                    } else {
+                        auto pos = static_cast<pos_t<Dim>>(upos_i);
+                        for (auto& sh : shs) {
+                            auto nbpos = pos + static_cast<pos_t<Dim>>(sh);
+                            if (inside(nbpos))
+                                add_nb(m_labels[offset(nbpos)]);
+                        }
+                    }
+                    th_saturated |= grs.saturated();
+                    if (!changed)
+                        return;
+
+                    tile_changed = true;
+                    --th_overflowed[overflow_slot(i, m_grain_sets[lbl].size())];
+                    ++th_overflowed[overflow_slot(i, grs.size())];
+                    label_type found = m_grain_sets.find(grs);
+                    if (found != grain_sets_type::npos)
+                        new_labels[i] = found;
+                    else
+                        th_misses.emplace_back(i, grs);
+                });
+                if (tile_changed)
+                    m_tiles.mark_dirty(t);
+            }
+
+            #pragma omp critical
+            {
+                misses.insert(misses.end(), th_misses.begin(), th_misses.end());
+                for (std::size_t k = 0; k <= Dim; ++k)
+                    m_num_overflowed[k] += th_overflowed[k];
+                m_saturated |= th_saturated;
             }
         }
+
+        std::sort(misses.begin(), misses.end(),
+            [](const auto& left, const auto& right) { return left.first < right.first; });
+        for (auto& [off, grs] : misses)
+            new_labels[off] = intern(grs);
+        m_labels = std::move(new_labels);
+        check_overflow();
     }
 
     void thin_boundary(std::size_t rng, std::size_t step = 1) {
+        // cells overflowed while regrowing may be extrapolated away at the end
+        auto hook = std::move(m_overflow_hook);
+        m_overflow_hook = nullptr;
         while (true) {
             if (rng + step >= range())
                 set_range(rng);
@@ -211,23 +596,39 @@ public:
                 set_range(range() - step);
             std::cout << "started range=" << range() << std::endl;
 
+            index_inner_cells();
             #pragma omp parallel for
             for (std::int64_t i = 0; i < m_clrgrains.size(); ++i) {
-                std::vector<std::size_t> inner_cells;
-                for (std::size_t j = 0; j < num_cells(); ++j)
-                    if (m_cells[j]->grains.front() == m_clrgrains[i].grain() &&
-                        m_cells[j]->grains.size() == 1)
-                        inner_cells.push_back(j);
-
-                m_clrgrains[i].extract_front_from(inner_cells,
-                    [this](std::size_t off, const grain_type* gr) -> bool {
-                        return m_cells[off]->grains.front() == gr && m_cells[off]->grains.size() == 1;
+                grain_index_type gr = m_grain_idxs[i];
+                m_clrgrains[i].extract_front_from(
+                    m_inner_cells.begin() + m_inner_starts[gr],
+                    m_inner_cells.begin() + m_inner_starts[gr + 1],
+                    [this, gr](std::size_t off, const grain_type*) -> bool {
+                        return is_inner(off, gr);
                     });
             }
 
-            for (auto& cl : m_cells)
-                if (cl->grains.size() > 1)
-                    cl = nullptr;
+            refresh_tiles();
+            std::size_t num_nulled = 0;
+            #pragma omp parallel for schedule(dynamic) reduction(+:num_nulled)
+            for (std::int64_t t = 0; t < static_cast<std::int64_t>(m_tiles.num_tiles()); ++t) {
+                if (m_tiles.uniform(t) && num_grains_of(m_tiles.label(t)) <= 1)
+                    continue;
+                std::size_t tile_nulled = 0;
+                for_each_tile_cell(t, [&](std::size_t off) {
+                    if (num_grains(off) > 1) {
+                        m_labels[off] = null_label;
+                        ++tile_nulled;
+                    }
+                });
+                if (tile_nulled > 0)
+                    m_tiles.mark_dirty(t);
+                num_nulled += tile_nulled;
+            }
+            m_num_null_cells += num_nulled;
+            m_crysted_bits_synced = false;
+            // every cell of more grains than one is null now
+            m_num_overflowed.fill(0);
 
             while (!stop_condition()) {
                 iterate();
@@ -239,129 +640,1049 @@ public:
                     }
                 }
                 if (all_empty_fronts)
-                    while (!extrapolate_nullcells());
+                    extrapolate_nullcells();
             }
 
+            refresh_tiles();
             std::size_t num_single_grained_cells = 0;
-            for (const cell_type* cl : m_cells)
-                if (cl->grains.size() == 1)
-                    ++num_single_grained_cells;
+            #pragma omp parallel for schedule(dynamic) reduction(+:num_single_grained_cells)
+            for (std::int64_t t = 0; t < static_cast<std::int64_t>(m_tiles.num_tiles()); ++t) {
+                if (m_tiles.uniform(t)) {
+                    if (num_grains_of(m_tiles.label(t)) == 1)
+                        num_single_grained_cells += tile_volume(t);
+                    continue;
+                }
+                for_each_tile_cell(t, [&](std::size_t off) {
+                    if (num_grains(off) == 1)
+                        ++num_single_grained_cells;
+                });
+            }
             if (range() == rng || num_single_grained_cells == num_cells())
                 break;
         }
-        while (!extrapolate_cells_with_numgrains_gt2());
+        extrapolate_cells_with_numgrains_gt2();
+        m_overflow_hook = std::move(hook);
+        check_overflow();
     }
 
     Real diam(std::vector<pos_t<Dim>> poses) const {
-        std::int64_t max_diff2 = 0.0;
-        for (pos_t<Dim> p0 : poses) {
-            std::int64_t maxd2 = 0;
-            for (pos_t<Dim> p1 : poses) {
-                std::int64_t d2 = (p1 - p0).magnitude2();
-                maxd2 = std::max(maxd2, d2);
-            }
-            max_diff2 = std::max(max_diff2, maxd2);
-        }
-
-        return std::sqrt(max_diff2);
+        return std::sqrt(static_cast<Real>(diam2<Dim>(std::move(poses))));
     }
 
-    Real cells_diam(cell_type* cell) const {
+    Real cells_diam(label_type lbl) const {
         std::vector<pos_t<Dim>> poses;
-        for (std::size_t i = 0; i < m_cells.size(); ++i)
-            if (cell == m_cells[i])
+        for (std::size_t i = 0; i < num_offsets(); ++i)
+            if (m_labels[i] == lbl)
                 poses.push_back(static_cast<pos_t<Dim>>(upos(i)));
 
         return diam(poses);
     }
 
+    // cells shared by the same set of grains
+    struct junction_stats {
+        label_type label;
+        std::size_t num_cells;
+        Real diam;
+        spt::vec<Dim, Real> centroid;
+        upos_t<Dim> min_corner;
+        upos_t<Dim> max_corner;
+    };
+
+    // statistics of every junction of order grains in label order,
+    // all of them are gathered by one pass over the grid
+    // labels without cells are left out
+    std::vector<junction_stats> junction_statistics(std::size_t order) const {
+        std::vector<std::size_t> bucket_of_label(m_grain_sets.size(), no_bucket);
+        std::vector<label_type> lbls;
+        for (std::size_t lbl = 0; lbl < m_grain_sets.size(); ++lbl) {
+            if (m_grain_sets[lbl].size() == order) {
+                bucket_of_label[lbl] = lbls.size();
+                lbls.push_back(static_cast<label_type>(lbl));
+            }
+        }
+
+        std::vector<std::size_t> starts;
+        std::vector<offset_type> cells;
+        bucket_cells(lbls.size(),
+            [this, &bucket_of_label](std::size_t off) -> std::size_t {
+                return crysted(off) ? bucket_of_label[m_labels[off]] : no_bucket;
+            },
+            starts, cells);
+
+        std::vector<junction_stats> res(lbls.size());
+        #pragma omp parallel for schedule(dynamic)
+        for (std::int64_t b = 0; b < static_cast<std::int64_t>(lbls.size()); ++b) {
+            auto& st = res[b];
+            st.label = lbls[b];
+            st.num_cells = starts[b + 1] - starts[b];
+            if (st.num_cells == 0)
+                continue;
+            st.min_corner = upos_t<Dim>::filled_with(std::numeric_limits<std::uint64_t>::max());
+            st.max_corner = upos_t<Dim>::filled_with(0);
+            st.centroid = spt::vec<Dim, Real>::filled_with(0);
+
+            std::vector<pos_t<Dim>> poses;
+            poses.reserve(st.num_cells);
+            for (std::size_t k = starts[b]; k < starts[b + 1]; ++k) {
+                auto pos = upos(cells[k]);
+                for (std::size_t i = 0; i < Dim; ++i) {
+                    st.min_corner[i] = std::min(st.min_corner[i], pos[i]);
+                    st.max_corner[i] = std::max(st.max_corner[i], pos[i]);
+                    st.centroid[i] += pos[i];
+                }
+                poses.push_back(static_cast<pos_t<Dim>>(pos));
+            }
+            st.centroid /= static_cast<Real>(st.num_cells);
+            st.diam = diam(std::move(poses));
+        }
+        // labels left without cells by thin_boundary or extrapolation
+        res.erase(std::remove_if(res.begin(), res.end(),
+            [](const junction_stats& st) { return st.num_cells == 0; }), res.end());
+
+        return res;
+    }
+
     std::vector<Real> diams_inter4() const {
         std::vector<Real> res;
-        for (auto& [grs, upcell] : m_unicells) {
-            if (grs.size() != 4)
-                continue;
+        for (auto& st : junction_statistics(4))
+            res.push_back(st.diam);
+
+        return res;
+    }
+
+    // the state as a checkpoint: labels, grain sets, materials and orientations of the grains,
+    // fronts, ranges and centers of the clr_grains, whether some set saturated. cells and fronts are stored in row-major
+    // order, so the checkpoint does not depend on Layout, Offset and Storage. compress stores
+    // the labels as runs
+    void save(std::ostream& os, bool compress = true) const {
+        chunk_writer out(os);
+        out.put_bytes(checkpoint_magic, sizeof(checkpoint_magic));
+        out.put(checkpoint_version);
+        out.put(checkpoint_byte_order);
+        out.put(static_cast<std::uint32_t>(Dim));
+        out.put(static_cast<std::uint32_t>(sizeof(Real)));
+        out.put(static_cast<std::uint32_t>(sizeof(label_type)));
+        out.put(static_cast<std::uint32_t>(compress));
+        for (std::size_t i = 0; i < Dim; ++i)
+            out.put(static_cast<std::uint64_t>(dim_lens()[i]));
+        out.put(static_cast<std::uint64_t>(m_range));
+        out.put(static_cast<std::uint8_t>(m_engine));
+        out.put(static_cast<std::uint8_t>(m_saturated));
+
+        std::vector<const material_type*> maters;
+        std::unordered_map<const material_type*, std::uint64_t> mater_indices;
+        for (auto gr : m_grains)
+            if (gr->material() && mater_indices.insert({ gr->material(), maters.size() }).second)
+                maters.push_back(gr->material());
+        out.put(static_cast<std::uint64_t>(maters.size()));
+        for (auto mater : maters) {
+            out.put(static_cast<std::uint64_t>(mater->grow_dirs().size()));
+            for (auto& gd : mater->grow_dirs())
+                for (std::size_t i = 0; i < Dim; ++i)
+                    out.put(gd[i]);
+        }
+        out.put(static_cast<std::uint64_t>(m_grains.size()));
+        for (auto gr : m_grains) {
+            out.put(gr->material() ? mater_indices[gr->material()] : no_material);
+            for (std::size_t i = 0; i < Dim; ++i)
+                for (std::size_t j = 0; j < Dim; ++j)
+                    out.put(gr->orientation()[i][j]);
+        }
+
+        out.put(static_cast<std::uint64_t>(m_grain_sets.size()));
+        for (auto& grs : m_grain_sets.keys()) {
+            out.put(static_cast<std::uint8_t>(grs.size()));
+            for (grain_index_type gr : grs)
+                out.put(gr);
+        }
+
+        m_storage.advise(m_labels, access_pattern::sequential);
+        if (compress) {
+            for (std::size_t i = 0; i < num_cells();) {
+                label_type lbl = m_labels[grid_offset(i)];
+                std::size_t j = i + 1;
+                while (j < num_cells() && m_labels[grid_offset(j)] == lbl)
+                    ++j;
+                out.put(lbl);
+                out.put(static_cast<std::uint64_t>(j - i));
+                i = j;
+            }
+        } else {
+            std::vector<label_type> buf;
+            buf.reserve(4096);
+            for (std::size_t i = 0; i < num_cells(); ++i) {
+                buf.push_back(m_labels[grid_offset(i)]);
+                if (buf.size() == buf.capacity() || i + 1 == num_cells()) {
+                    out.put_bytes(buf.data(), buf.size() * sizeof(label_type));
+                    buf.clear();
+                }
+            }
+        }
+
+        out.put(static_cast<std::uint64_t>(m_clrgrains.size()));
+        for (std::size_t k = 0; k < m_clrgrains.size(); ++k) {
+            auto& clrg = m_clrgrains[k];
+            out.put(m_grain_idxs[k]);
+            out.put(static_cast<std::uint8_t>(clrg.kind()));
+            out.put(static_cast<std::uint64_t>(grid_index(offset(clrg.center()))));
+            out.put(static_cast<std::uint64_t>(clrg.range()));
+            out.put(static_cast<std::uint64_t>(clrg.front().size()));
+            for (offset_type off : clrg.front())
+                out.put(static_cast<std::uint64_t>(grid_index(off)));
+        }
+        out.finish();
+    }
 
-            res.push_back(cells_diam(upcell.get()));
+    // automata saved by save(), its grains and materials are made in pool.
+    // throws std::runtime_error on a corrupted or incompatible checkpoint
+    static automata load(std::istream& is, grain_pool<Dim, Real>& pool, Storage storage = Storage()) {
+        chunk_reader in(is);
+        auto fail = [](const char* what) {
+            throw std::runtime_error(std::string("cgr::automata::load: ") + what);
+        };
+        char magic[sizeof(checkpoint_magic)];
+        in.get_bytes(magic, sizeof(magic));
+        if (!std::equal(magic, magic + sizeof(magic), checkpoint_magic))
+            fail("not a checkpoint");
+        if (in.get<std::uint32_t>() != checkpoint_version)
+            fail("unsupported version");
+        if (in.get<std::uint32_t>() != checkpoint_byte_order)
+            fail("byte order differs");
+        if (in.get<std::uint32_t>() != Dim
+            || in.get<std::uint32_t>() != sizeof(Real)
+            || in.get<std::uint32_t>() != sizeof(label_type))
+            fail("dimension, Real or Label differs");
+        bool compressed = in.get<std::uint32_t>() != 0;
+        upos_t<Dim> dimlens;
+        for (std::size_t i = 0; i < Dim; ++i)
+            dimlens[i] = in.get<std::uint64_t>();
+
+        automata res(dimlens, std::move(storage));
+        res.m_range = in.get<std::uint64_t>();
+        auto engine = in.get<std::uint8_t>();
+        if (engine > static_cast<std::uint8_t>(front_engine::bitset))
+            fail("unknown front engine");
+        res.set_engine(static_cast<front_engine>(engine));
+        // a saturated set holds as many grains as a full one, so it can not be told from the sets
+        res.m_saturated = in.get<std::uint8_t>() != 0;
+
+        pool.materials.resize(in.get<std::uint64_t>());
+        for (auto& mater : pool.materials) {
+            std::vector<grow_dir_type> gdirs(in.get<std::uint64_t>());
+            for (auto& gd : gdirs)
+                for (std::size_t i = 0; i < Dim; ++i)
+                    gd[i] = in.get<Real>();
+            mater = material_type(std::move(gdirs));
+        }
+        std::size_t num_grains = in.get<std::uint64_t>();
+        pool.grains.clear();
+        pool.grains.reserve(num_grains);
+        for (std::size_t g = 0; g < num_grains; ++g) {
+            auto mater_idx = in.get<std::uint64_t>();
+            if (mater_idx != no_material && mater_idx >= pool.materials.size())
+                fail("material index out of range");
+            auto orien = orientation_type::identity();
+            for (std::size_t i = 0; i < Dim; ++i)
+                for (std::size_t j = 0; j < Dim; ++j)
+                    orien[i][j] = in.get<Real>();
+            pool.grains.emplace_back(mater_idx == no_material ? nullptr : &pool.materials[mater_idx], orien);
+        }
+        for (auto& gr : pool.grains) {
+            res.m_grain_indices.insert({ &gr, static_cast<grain_index_type>(res.m_grains.size()) });
+            res.m_grains.push_back(&gr);
         }
 
+        std::size_t num_sets = in.get<std::uint64_t>();
+        if (num_sets > null_label)
+            fail("too many grain sets for Label");
+        for (std::size_t lbl = 0; lbl < num_sets; ++lbl) {
+            std::size_t size = in.get<std::uint8_t>();
+            if (size > max_cell_grains)
+                fail("grain set too large");
+            grain_set_type grs;
+            for (std::size_t k = 0; k < size; ++k) {
+                auto gr = in.get<grain_index_type>();
+                if (gr >= num_grains)
+                    fail("grain index out of range");
+                grs.insert(gr);
+            }
+            if (res.intern(grs) != lbl)
+                fail("duplicate grain set");
+        }
+
+        auto check_label = [num_sets, &fail](label_type lbl) {
+            if (lbl != null_label && lbl >= num_sets)
+                fail("label out of range");
+        };
+        std::size_t num_null = 0;
+        if (compressed) {
+            for (std::size_t i = 0; i < res.num_cells();) {
+                auto lbl = in.get<label_type>();
+                auto run = in.get<std::uint64_t>();
+                check_label(lbl);
+                if (run == 0 || run > res.num_cells() - i)
+                    fail("label run out of range");
+                for (std::size_t j = i + run; i < j; ++i)
+                    res.m_labels[res.grid_offset(i)] = lbl;
+                if (lbl == null_label)
+                    num_null += run;
+            }
+        } else {
+            for (std::size_t i = 0; i < res.num_cells(); ++i) {
+                auto lbl = in.get<label_type>();
+                check_label(lbl);
+                res.m_labels[res.grid_offset(i)] = lbl;
+                num_null += lbl == null_label;
+            }
+        }
+        res.m_num_null_cells = num_null;
+        res.recount_overflowed();
+
+        std::size_t num_clrgrains = in.get<std::uint64_t>();
+        std::vector<offset_type> front;
+        for (std::size_t k = 0; k < num_clrgrains; ++k) {
+            auto gr = in.get<grain_index_type>();
+            auto kind = in.get<std::uint8_t>();
+            auto center = in.get<std::uint64_t>();
+            auto rng = in.get<std::uint64_t>();
+            if (gr >= num_grains || center >= res.num_cells())
+                fail("clr_grain out of range");
+            if (kind > static_cast<std::uint8_t>(nbh::nbhood_kind::crystallographic))
+                fail("unknown nbhood_kind");
+            front.resize(in.get<std::uint64_t>());
+            for (auto& off : front) {
+                auto i = in.get<std::uint64_t>();
+                if (i >= res.num_cells())
+                    fail("front cell out of range");
+                off = static_cast<offset_type>(res.grid_offset(i));
+            }
+
+            res.add_clr_grain(res.m_grains[gr], static_cast<nbh::nbhood_kind>(kind), res.grid_offset(center));
+            res.m_clrgrains.back().set_range(rng);
+            res.m_clrgrains.back().assign_front(front.begin(), front.end());
+        }
+        in.finish();
         return res;
     }
 
-    automata(std::size_t dimlen)
-        : automata(upos_t<Dim>::filled_with(dimlen)) {}
-    automata(const upos_t<Dim>& dimlens) : m_dim_lens{ dimlens } {
-        std::size_t new_num_cells = std::accumulate(
-            m_dim_lens.x.begin(), m_dim_lens.x.end(),
+    automata(std::size_t dimlen, Storage storage = Storage())
+        : automata(upos_t<Dim>::filled_with(dimlen), std::move(storage)) {}
+    automata(const upos_t<Dim>& dimlens, Storage storage = Storage())
+        : m_layout{ dimlens }, m_stencils{ std::make_shared<stencil_cache_type>(dimlens) },
+          m_tiles{ dimlens }, m_storage{ std::move(storage) } {
+        // the deltas of the stencils are signed Offset
+        using delta_type = std::make_signed_t<offset_type>;
+        if (m_layout.num_offsets() > static_cast<std::size_t>(std::numeric_limits<delta_type>::max()))
+            throw std::overflow_error("cgr::automata: the grid does not fit in Offset");
+        m_num_cells = std::accumulate(
+            dimlens.x.begin(), dimlens.x.end(),
             static_cast<std::size_t>(1), std::multiplies<std::size_t>());
-        m_cells.assign(new_num_cells, nullptr);
+        m_labels = m_storage.make(m_layout.num_offsets(), null_label);
+        m_num_null_cells = m_num_cells;
     }
 
 
 private:
     std::size_t m_range = 0;
-    upos_t<Dim> m_dim_lens;
+    Layout m_layout;
+    std::size_t m_num_cells = 0;
+    // shared by the clr_grains
+    std::shared_ptr<stencil_cache_type> m_stencils;
+    front_engine m_engine = front_engine::stencil;
+    // crysted cells in row-major order, kept up to date by commit_fronts() once synced
+    grid_bitset m_crysted_bits;
+    bool m_crysted_bits_synced = false;
+    // uniform and dirty tiles of the labels, 64 cells each
+    tiles_type m_tiles;
 
-    std::vector<cell_type*> m_cells;
+    Storage m_storage;
+    labels_type m_labels;
+    std::size_t m_num_null_cells = 0;
     std::vector<clr_grain_type> m_clrgrains;
-    std::map<std::set<const grain_type*>, std::unique_ptr<cell_type>> m_unicells;
+    // grain index and single grain label of each clr_grain
+    std::vector<grain_index_type> m_grain_idxs;
+    std::vector<label_type> m_grain_labels;
+    std::vector<const grain_type*> m_grains;
+    std::unordered_map<const grain_type*, grain_index_type> m_grain_indices;
+    grain_sets_type m_grain_sets;
+    std::vector<std::size_t> m_inner_starts;
+    std::vector<offset_type> m_inner_cells;
+    std::vector<cell_type> m_unicells;
+    // overflowed cells by the number of box faces they lie on
+    std::array<std::size_t, Dim + 1> m_num_overflowed{};
+    overflow_hook_type m_overflow_hook;
+    bool m_saturated = false;
 
-    template <typename Pred>
-    bool extrapolate_cells(Pred pred) {
-        bool success = true;
+    bool crysted(std::size_t off) const {
+        return m_labels[off] != null_label;
+    }
+    std::size_t num_grains(std::size_t off) const {
+        return num_grains_of(m_labels[off]);
+    }
+    std::size_t num_grains_of(label_type lbl) const {
+        return lbl != null_label ? m_grain_sets[lbl].size() : 0;
+    }
+    bool is_inner(std::size_t off, grain_index_type gr) const {
+        if (!crysted(off))
+            return false;
+        auto& grs = m_grain_sets[m_labels[off]];
+        return grs.front() == gr && grs.size() == 1;
+    }
+
+    // index into m_num_overflowed of the cell of num_grains grains, Dim + 1 if it is not overflowed
+    std::size_t overflow_slot(std::size_t off, std::size_t num_grains) const {
+        if (num_grains + Dim <= max_cell_order)
+            return Dim + 1;
+        auto pos = upos(off);
+        std::size_t num_box_faces = 0;
+        for (std::size_t i = 0; i < Dim; ++i)
+            num_box_faces += pos[i] == 0 || pos[i] + 1 == dim_lens()[i];
+        return num_grains + num_box_faces > max_cell_order ? num_box_faces : Dim + 1;
+    }
+    void count_overflow(std::size_t off, std::size_t num_grains, std::int64_t delta) {
+        std::size_t slot = overflow_slot(off, num_grains);
+        if (slot <= Dim)
+            m_num_overflowed[slot] += delta;
+    }
+    void recount_overflowed() {
+        m_num_overflowed.fill(0);
+        #pragma omp parallel
+        {
+            std::array<std::size_t, Dim + 2> th_overflowed{};
+            #pragma omp for
+            for (std::int64_t i = 0; i < static_cast<std::int64_t>(num_offsets()); ++i)
+                ++th_overflowed[overflow_slot(i, num_grains(i))];
+            #pragma omp critical
+            for (std::size_t k = 0; k <= Dim; ++k)
+                m_num_overflowed[k] += th_overflowed[k];
+        }
+    }
+    void check_overflow() const {
+        if (m_overflow_hook && num_overflowed_cells() > 0)
+            m_overflow_hook(*this);
+    }
+
+    static constexpr std::uint32_t edt_no_site = std::numeric_limits<std::uint32_t>::max();
+
+    static constexpr char checkpoint_magic[8] = { 'c', 'g', 'r', 'c', 'k', 'p', 't', '\0' };
+    static constexpr std::uint32_t checkpoint_version = 2;
+    static constexpr std::uint32_t checkpoint_byte_order = 0x01020304;
+    static constexpr std::uint64_t no_material = std::numeric_limits<std::uint64_t>::max();
+
+    // exact rational, den == 0 stands for -inf or +inf by the sign of num
+    struct edt_frac {
+        std::int64_t num;
+        std::int64_t den;
+
+        bool operator<(const edt_frac& right) const {
+            if (den == 0 || right.den == 0)
+                return (den == 0 ? num : 0) < (right.den == 0 ? right.num : 0);
+            return num * right.den < right.num * den;
+        }
+    };
+
+    struct edt_parabola {
+        std::int64_t apex;
+        std::int64_t height;
+        std::uint32_t site;
+
+        std::int64_t operator()(std::int64_t x) const {
+            return height + (x - apex) * (x - apex);
+        }
+    };
+
+    struct edt_scratch {
+        std::vector<edt_parabola> env;
+        std::vector<edt_frac> bounds;
+
+        edt_scratch(std::size_t len) : env(len), bounds(len + 1) {}
+    };
+
+    // sites along the line are the nearest nuclei among the ones sharing the cell's
+    // coordinate along axis k, afterwards among the ones sharing coordinates along axes > k.
+    // a parabola is popped only when it is nowhere minimal, so a tie at an integer point
+    // keeps every tying parabola and the least site wins like in voronoi()
+    // at(t) is the offset of the t-th cell of the line
+    template <typename AtFn>
+    void edt_line(array_type<std::uint32_t>& sites, const upos_t<Dim>& line_upos, std::size_t k,
+                  edt_scratch& scratch, AtFn at) const {
+        auto line_pos = static_cast<pos_t<Dim>>(line_upos);
+        std::int64_t len = dim_lens()[k];
+        auto& env = scratch.env;
+        auto& bounds = scratch.bounds;
+
+        std::size_t m = 0;
+        for (std::int64_t t = 0; t < len; ++t) {
+            std::uint32_t site = sites[at(t)];
+            if (site == edt_no_site)
+                continue;
+
+            auto center = static_cast<pos_t<Dim>>(m_clrgrains[site].center());
+            std::int64_t height = 0;
+            for (std::size_t a = 0; a < k; ++a)
+                height += (line_pos[a] - center[a]) * (line_pos[a] - center[a]);
+            edt_parabola par{ t, height, site };
+
+            edt_frac s{ -1, 0 };
+            while (m > 0) {
+                auto& top = env[m - 1];
+                s = { (par.height + par.apex * par.apex) - (top.height + top.apex * top.apex), 2 * (par.apex - top.apex) };
+                if (!(s < bounds[m - 1]))
+                    break;
+                --m;
+                s = { -1, 0 };
+            }
+            env[m] = par;
+            bounds[m] = s;
+            bounds[++m] = { 1, 0 };
+        }
+        if (m == 0)
+            return;
+
+        std::size_t j = 0;
+        for (std::int64_t x = 0; x < len; ++x) {
+            edt_frac fx{ x, 1 };
+            while (j + 1 < m && bounds[j + 1] < fx)
+                ++j;
+
+            std::int64_t best = env[j](x);
+            std::uint32_t best_site = env[j].site;
+            for (std::size_t jj = j + 1; jj < m && !(fx < bounds[jj]); ++jj) {
+                std::int64_t val = env[jj](x);
+                if (val < best || (val == best && env[jj].site < best_site)) {
+                    best = val;
+                    best_site = env[jj].site;
+                }
+            }
+            sites[at(x)] = best_site;
+        }
+    }
+
+    // first cell of the l-th line along axis k, lines are numbered row-major by the rest axes
+    upos_t<Dim> line_start(std::size_t l, std::size_t k) const {
+        upos_t<Dim> res;
+        for (std::size_t i = 0; i < Dim; ++i) {
+            if (i == k) {
+                res[i] = 0;
+                continue;
+            }
+            res[i] = l % dim_lens()[i];
+            l /= dim_lens()[i];
+        }
+        return res;
+    }
+
+    template <nbh::nbhood_kind NbhKind>
+    static std::size_t voronoi_dist(const clr_grain_type& clrg, const pos_t<Dim>& diff) {
+        if constexpr (NbhKind == nbh::nbhood_kind::crystallographic)
+            return clrg.norm(diff);
+        else if constexpr (NbhKind == nbh::nbhood_kind::euclid)
+            return norm2_euclid(diff);
+        else if constexpr (NbhKind == nbh::nbhood_kind::moore)
+            return norm_taxicab(diff);
+        else
+            return norm_chebyshev(diff);
+    }
+
+    bucket_grid<Dim> make_nucleus_buckets() const {
+        std::vector<upos_t<Dim>> centers;
+        centers.reserve(m_clrgrains.size());
+        for (auto& clrg : m_clrgrains)
+            centers.push_back(clrg.center());
+        return bucket_grid<Dim>(dim_lens(), centers);
+    }
+
+    // lower bound of voronoi_dist / norm_chebyshev over all nuclei
+    template <nbh::nbhood_kind NbhKind>
+    Real min_norm_ratio() const {
+        Real res = 1;
+        if constexpr (NbhKind == nbh::nbhood_kind::crystallographic)
+            for (auto& clrg : m_clrgrains)
+                res = std::min(res, clrg.min_norm_ratio());
+        return res;
+    }
+
+    // index of the nucleus nearest to pos, ties go to the least index
+    template <nbh::nbhood_kind NbhKind>
+    std::size_t nearest_nucleus(const bucket_grid<Dim>& buckets, Real min_ratio, const upos_t<Dim>& upos) const {
+        auto pos = static_cast<pos_t<Dim>>(upos);
+        std::size_t closest = 0;
+        std::size_t min_dist = std::numeric_limits<std::size_t>::max();
+
+        buckets.visit_rings(upos,
+            [&](std::size_t j) {
+                auto diff = static_cast<pos_t<Dim>>(m_clrgrains[j].center()) - pos;
+                if constexpr (NbhKind == nbh::nbhood_kind::crystallographic) {
+                    auto lb = static_cast<std::size_t>(m_clrgrains[j].min_norm_ratio() * norm_chebyshev(diff));
+                    if (lb > min_dist || (lb == min_dist && j > closest))
+                        return;
+                }
+
+                std::size_t dist = voronoi_dist<NbhKind>(m_clrgrains[j], diff);
+                if (dist < min_dist || (dist == min_dist && j < closest)) {
+                    min_dist = dist;
+                    closest = j;
+                }
+            },
+            [&](std::size_t cheb_lb) -> bool {
+                std::size_t lb = cheb_lb;
+                if constexpr (NbhKind == nbh::nbhood_kind::crystallographic)
+                    lb = static_cast<std::size_t>(min_ratio * cheb_lb);
+                else if constexpr (NbhKind == nbh::nbhood_kind::euclid)
+                    lb = cheb_lb * cheb_lb;
+                return lb > min_dist;
+            });
+
+        return closest;
+    }
 
-        auto shs = nbh::make_shifts<Dim>(norm_euclid<Dim>, 1);
-        for (std::size_t i = 0; i < num_cells(); ++i) {
-            if (!pred(i)) continue;
+    static constexpr std::size_t voronoi_run = 8;
+
+    // voronoi<crystallographic>() by runs of voronoi_run cells along x, a nucleus met
+    // by the ring search around the middle of a run is measured for the whole run
+    // in one batch. the distance from any cell of the run to the nuclei not met yet
+    // is at least the bound of the search lowered by half of the run
+    std::size_t voronoi_cryst_runs(const bucket_grid<Dim>& buckets, Real min_ratio) {
+        std::size_t len = dim_lens()[0];
+        std::size_t runs_per_line = (len + voronoi_run - 1) / voronoi_run;
+        std::size_t num_runs = num_cells() / len * runs_per_line;
+
+        std::size_t num_filled = 0;
+        #pragma omp parallel reduction(+:num_filled)
+        {
+            pos_batch<Dim, Real> diffs;
+            std::array<std::size_t, voronoi_run> offs, dists, min_dists, closest;
+            #pragma omp for schedule(dynamic, 64)
+            for (std::int64_t r = 0; r < static_cast<std::int64_t>(num_runs); ++r) {
+                auto run_pos = line_start(r / runs_per_line, 0);
+                run_pos[0] = r % runs_per_line * voronoi_run;
+                std::size_t n = std::min(voronoi_run, len - run_pos[0]);
+
+                bool any_empty = false;
+                for (std::size_t t = 0; t < n; ++t) {
+                    auto pos = run_pos;
+                    pos[0] += t;
+                    offs[t] = offset(pos);
+                    any_empty |= m_labels[offs[t]] == null_label;
+                    // filled cells never hold the search
+                    min_dists[t] = m_labels[offs[t]] == null_label ? std::numeric_limits<std::size_t>::max() : 0;
+                    closest[t] = 0;
+                }
+                if (!any_empty)
+                    continue;
 
+                auto mid = run_pos;
+                mid[0] += (n - 1) / 2;
+                std::size_t half = n / 2;
+                buckets.visit_rings(mid,
+                    [&](std::size_t j) {
+                        auto diff = static_cast<pos_t<Dim>>(m_clrgrains[j].center()) - static_cast<pos_t<Dim>>(run_pos);
+                        diffs.clear();
+                        for (std::size_t t = 0; t < n; ++t, --diff[0])
+                            diffs.push_back(diff);
+                        m_clrgrains[j].norms(diffs, dists.data());
+                        for (std::size_t t = 0; t < n; ++t) {
+                            if (dists[t] < min_dists[t] || (dists[t] == min_dists[t] && j < closest[t])) {
+                                min_dists[t] = dists[t];
+                                closest[t] = j;
+                            }
+                        }
+                    },
+                    [&](std::size_t cheb_lb) -> bool {
+                        if (cheb_lb <= half)
+                            return false;
+                        auto lb = static_cast<std::size_t>(min_ratio * (cheb_lb - half));
+                        return lb > *std::max_element(min_dists.begin(), min_dists.begin() + n);
+                    });
+
+                for (std::size_t t = 0; t < n; ++t) {
+                    if (m_labels[offs[t]] != null_label)
+                        continue;
+                    m_labels[offs[t]] = m_grain_labels[closest[t]];
+                    ++num_filled;
+                }
+            }
+        }
+
+        return num_filled;
+    }
+
+    // every cell takes the nearest of its own site and the sites step cells away along shifts
+    template <nbh::nbhood_kind NbhKind>
+    void jfa_pass(const array_type<std::uint32_t>& sites, array_type<std::uint32_t>& next_sites,
+                  const std::vector<pos_t<Dim>>& shifts, std::size_t step) const {
+        std::int64_t sstep = step;
+        #pragma omp parallel for
+        for (std::int64_t i = 0; i < num_offsets(); ++i) {
+            if (!valid(i))
+                continue;
             auto pos = static_cast<pos_t<Dim>>(upos(i));
-            std::vector<pos_t<Dim>> nbs = nbh::apply_shifts(pos, shs,
-                [this](const pos_t<Dim>& pos) -> bool { return inside(pos); });
-
-            std::vector<std::pair<const cell_type*, std::size_t>> prs;
-            auto prs_find_cell = [&prs](const cell_type* cl) -> std::size_t {
-                std::size_t i = 0;
-                for (; i < prs.size(); ++i)
-                    if (prs[i].first == cl)
-                        break;
-                return i;
-            };
+            std::uint32_t best = sites[i];
+            std::size_t min_dist = std::numeric_limits<std::size_t>::max();
+            if (best != edt_no_site)
+                min_dist = voronoi_dist<NbhKind>(m_clrgrains[best], static_cast<pos_t<Dim>>(m_clrgrains[best].center()) - pos);
+
+            for (auto& shift : shifts) {
+                auto npos = pos + shift * sstep;
+                if (!inside(npos))
+                    continue;
+                std::uint32_t site = sites[offset(npos)];
+                if (site == edt_no_site || site == best)
+                    continue;
+                std::size_t dist = voronoi_dist<NbhKind>(m_clrgrains[site], static_cast<pos_t<Dim>>(m_clrgrains[site].center()) - pos);
+                if (dist < min_dist || (dist == min_dist && site < best)) {
+                    min_dist = dist;
+                    best = site;
+                }
+            }
+            next_sites[i] = best;
+        }
+    }
+
+    // jump flooding errs near the borders of the regions only,
+    // so the cells with a face neighbour of other site are searched exactly
+    template <nbh::nbhood_kind NbhKind>
+    std::size_t jfa_verify(array_type<std::uint32_t>& sites) const {
+        auto buckets = make_nucleus_buckets();
+        Real min_ratio = min_norm_ratio<NbhKind>();
+        auto face_shifts = nbh::make_shifts<Dim>(taxicab_norm<Dim>(), 1);
+        auto checked = m_storage.make(num_offsets(), edt_no_site);
+        #pragma omp parallel for
+        for (std::int64_t i = 0; i < num_offsets(); ++i)
+            checked[i] = sites[i];
+
+        std::size_t num_wrong = 0;
+        #pragma omp parallel for schedule(dynamic, 4096) reduction(+:num_wrong)
+        for (std::int64_t i = 0; i < num_offsets(); ++i) {
+            if (!valid(i))
+                continue;
+            auto pos = static_cast<pos_t<Dim>>(upos(i));
+            bool on_border = sites[i] == edt_no_site;
+            for (std::size_t k = 0; k < face_shifts.size() && !on_border; ++k) {
+                auto npos = pos + face_shifts[k];
+                on_border = inside(npos) && sites[offset(npos)] != sites[i];
+            }
+            if (!on_border)
+                continue;
 
-            for (auto& nb : nbs) {
-                const cell_type* nbcl = cell(nb);
-                if (!nbcl || pred(offset(nb))) continue;
+            auto exact = static_cast<std::uint32_t>(nearest_nucleus<NbhKind>(buckets, min_ratio, upos(i)));
+            if (exact != sites[i]) {
+                checked[i] = exact;
+                ++num_wrong;
+            }
+        }
+        sites.swap(checked);
+
+        return num_wrong;
+    }
+
+    // cells of a chunk are processed by one thread, the count is fixed
+    // so that labels are numbered the same for any number of threads
+    static constexpr std::size_t max_chunks = 256;
 
-                std::size_t find_res = prs_find_cell(nbcl);
-                if (find_res == prs.size())
-                    prs.push_back({ nbcl, 1 });
+    std::size_t num_chunks() const {
+        return std::clamp<std::size_t>(num_offsets() / 4096, 1, max_chunks);
+    }
+
+    // fn(off) for the cells of tile t, rows along x in increasing order
+    template <typename Fn>
+    void for_each_tile_cell(std::size_t t, Fn fn) const {
+        auto lo = m_tiles.min_corner(t);
+        auto hi = m_tiles.max_corner(t);
+        auto pos = lo;
+        while (true) {
+            if constexpr (Layout::is_linear) {
+                std::size_t first = offset(pos);
+                for (std::size_t x = 0; x <= hi[0] - lo[0]; ++x)
+                    fn(first + x);
+            } else {
+                auto cpos = pos;
+                for (cpos[0] = lo[0]; cpos[0] <= hi[0]; ++cpos[0])
+                    fn(offset(cpos));
+            }
+            std::size_t i = 1;
+            for (; i < Dim && ++pos[i] > hi[i]; ++i)
+                pos[i] = lo[i];
+            if (i == Dim)
+                return;
+        }
+    }
+
+    std::size_t tile_volume(std::size_t t) const {
+        auto lo = m_tiles.min_corner(t);
+        auto hi = m_tiles.max_corner(t);
+        std::size_t res = 1;
+        for (std::size_t i = 0; i < Dim; ++i)
+            res *= hi[i] - lo[i] + 1;
+        return res;
+    }
+
+    // tile t and the tiles within ring tiles around it hold the same single label
+    bool settled_tile(std::size_t t, std::size_t ring) const {
+        if (!m_tiles.uniform(t))
+            return false;
+        return m_tiles.all_of_ring(t, ring, [this, lbl = m_tiles.label(t)](std::size_t s) -> bool {
+            return m_tiles.uniform(s) && m_tiles.label(s) == lbl;
+        });
+    }
+
+    void refresh_tiles() {
+        m_tiles.refresh([this](std::size_t t, label_type& lbl) -> bool {
+            lbl = m_labels[offset(m_tiles.min_corner(t))];
+            bool res = true;
+            for_each_tile_cell(t, [&](std::size_t off) { res &= m_labels[off] == lbl; });
+            return res;
+        });
+    }
+
+    // index of the cell in row-major order
+    std::size_t grid_index(std::size_t off) const {
+        if constexpr (Layout::is_linear)
+            return off;
+        else
+            return cgr::offset(static_cast<pos_t<Dim>>(upos(off)), dim_lens());
+    }
+    // offset of the i-th cell in row-major order
+    std::size_t grid_offset(std::size_t i) const {
+        if constexpr (Layout::is_linear)
+            return i;
+        else
+            return offset(cgr::upos(i, dim_lens()));
+    }
+
+    void sync_crysted_bits() {
+        if (m_crysted_bits_synced)
+            return;
+        m_storage.advise(m_labels, access_pattern::sequential);
+        m_crysted_bits.assign(num_cells(),
+            [this](std::size_t i) -> bool {
+                if constexpr (Layout::is_linear)
+                    return crysted(i);
                 else
-                    ++prs[find_res].second;
+                    return crysted(offset(cgr::upos(i, dim_lens())));
+            });
+        m_crysted_bits_synced = true;
+    }
+
+    static constexpr std::size_t no_bucket = std::numeric_limits<std::size_t>::max();
+
+    // counting sort of the cells into buckets by bucket_of(off), no_bucket skips a cell.
+    // cells of bucket b are cells[starts[b]..starts[b + 1]) in increasing offset order,
+    // they are counted per bucket and chunk, then scattered chunk by chunk
+    template <typename BucketFn>
+    void bucket_cells(std::size_t num_buckets, BucketFn bucket_of,
+                      std::vector<std::size_t>& starts, std::vector<offset_type>& cells) const {
+        std::size_t num_chunks = this->num_chunks();
+        std::size_t chunk_size = (num_offsets() + num_chunks - 1) / num_chunks;
+        std::vector<std::size_t> fill(num_buckets * num_chunks, 0);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (std::int64_t c = 0; c < static_cast<std::int64_t>(num_chunks); ++c) {
+            std::size_t end = std::min((c + 1) * chunk_size, num_offsets());
+            for (std::size_t i = c * chunk_size; i < end; ++i)
+                if (std::size_t b = bucket_of(i); b != no_bucket)
+                    ++fill[b * num_chunks + c];
+        }
+
+        starts.assign(num_buckets + 1, 0);
+        std::size_t total = 0;
+        for (std::size_t b = 0; b < num_buckets; ++b) {
+            starts[b] = total;
+            for (std::size_t c = 0; c < num_chunks; ++c) {
+                std::size_t count = fill[b * num_chunks + c];
+                fill[b * num_chunks + c] = total;
+                total += count;
             }
-            std::sort(prs.begin(), prs.end(),
-                [](const auto& pr0, const auto& pr1) -> bool {
-                    return pr0.second < pr1.second;
-                });
+        }
+        starts.back() = total;
+        cells.resize(total);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (std::int64_t c = 0; c < static_cast<std::int64_t>(num_chunks); ++c) {
+            std::size_t end = std::min((c + 1) * chunk_size, num_offsets());
+            for (std::size_t i = c * chunk_size; i < end; ++i)
+                if (std::size_t b = bucket_of(i); b != no_bucket)
+                    cells[fill[b * num_chunks + c]++] = static_cast<offset_type>(i);
+        }
+    }
+
+    // cells owned by a single grain per grain index,
+    // cells of grain gr are m_inner_cells[m_inner_starts[gr]..m_inner_starts[gr + 1])
+    void index_inner_cells() {
+        bucket_cells(m_grains.size(),
+            [this](std::size_t off) -> std::size_t {
+                return num_grains(off) == 1 ? m_grain_sets[m_labels[off]].front() : no_bucket;
+            },
+            m_inner_starts, m_inner_cells);
+    }
+
+    void add_clr_grain(const grain_type* grain, nbh::nbhood_kind kind, std::size_t nucleus_off) {
+        m_clrgrains.emplace_back(grain, kind, m_layout, nucleus_off, m_stencils);
+        m_clrgrains.back().set_range(m_range);
+
+        auto [it, success] = m_grain_indices.insert({ grain, static_cast<grain_index_type>(m_grains.size()) });
+        if (success)
+            m_grains.push_back(grain);
+        m_grain_idxs.push_back(it->second);
+        m_grain_labels.push_back(intern({ it->second }));
+    }
+
+    label_type intern(const grain_set_type& grs) {
+        auto [lbl, success] = m_grain_sets.insert(grs);
+        if (success) {
+            m_unicells.emplace_back(nullptr, true);
+            for (grain_index_type gr : grs)
+                m_unicells.back().grains.push_back(m_grains[gr]);
+        }
+        return lbl;
+    }
+
+    // offsets pushed by fn(k, out) for k in [0, n) from all threads, sorted and unique
+    template <typename Fn>
+    static std::vector<std::size_t> collect_offsets(std::size_t n, Fn fn) {
+        std::vector<std::size_t> res;
+        #pragma omp parallel
+        {
+            std::vector<std::size_t> th_res;
+            #pragma omp for schedule(dynamic, 1024)
+            for (std::int64_t k = 0; k < static_cast<std::int64_t>(n); ++k)
+                fn(k, th_res);
+
+            #pragma omp critical
+            res.insert(res.end(), th_res.begin(), th_res.end());
+        }
+        std::sort(res.begin(), res.end());
+        res.erase(std::unique(res.begin(), res.end()), res.end());
+        return res;
+    }
 
-            if (prs.empty()) {
-                success = false;
+    // cells whose label satisfies pred are filled layer by layer starting from those touching
+    // the crysted cells that do not, each takes the label most frequent among its
+    // filled adjacent cells, the least one on ties. a layer reads only the labels
+    // written before it, so the result is the same for any scan order and number of threads.
+    // uniform tiles are told by pred once, the first layer is looked for in the tiles
+    // with cells to fill only. returns false if some of the cells can not be reached
+    template <typename Pred>
+    bool extrapolate_cells(Pred pred) {
+        // unit euclid shifts truncate the norm, so they reach all 3^Dim - 1 adjacent cells
+        constexpr std::size_t max_adjacent = Dim == 2 ? 8 : 26;
+        auto shs = nbh::make_shifts<Dim>(euclid_norm<Dim>(), 1);
+        auto for_each_nb = [this, &shs](std::size_t off, auto fn) {
+            auto pos = static_cast<pos_t<Dim>>(upos(off));
+            for (auto& sh : shs)
+                if (inside(pos + sh))
+                    fn(offset(pos + sh));
+        };
+
+        m_storage.advise(m_labels, access_pattern::sequential);
+        refresh_tiles();
+        auto pending = m_storage.make(num_offsets(), static_cast<std::uint8_t>(0));
+        std::vector<std::uint8_t> tile_pending(m_tiles.num_tiles(), 0);
+        std::size_t num_pending = 0;
+        #pragma omp parallel for schedule(dynamic) reduction(+:num_pending)
+        for (std::int64_t t = 0; t < static_cast<std::int64_t>(m_tiles.num_tiles()); ++t) {
+            if (m_tiles.uniform(t) && !pred(m_tiles.label(t)))
                 continue;
+            std::size_t tile_num_pending = 0;
+            for_each_tile_cell(t, [&](std::size_t off) {
+                pending[off] = pred(m_labels[off]);
+                tile_num_pending += pending[off];
+            });
+            tile_pending[t] = tile_num_pending > 0;
+            num_pending += tile_num_pending;
+        }
+        auto is_donor = [this, &pending](std::size_t off) -> bool {
+            return !pending[off] && crysted(off);
+        };
+
+        auto layer = collect_offsets(m_tiles.num_tiles(),
+            [&](std::size_t t, std::vector<std::size_t>& out) {
+                if (!tile_pending[t])
+                    return;
+                for_each_tile_cell(t, [&](std::size_t i) {
+                    if (!pending[i])
+                        return;
+                    bool touches = false;
+                    for_each_nb(i, [&](std::size_t nboff) { touches |= is_donor(nboff); });
+                    if (touches)
+                        out.push_back(i);
+                });
+            });
+
+        std::vector<label_type> new_labels;
+        while (!layer.empty()) {
+            new_labels.resize(layer.size());
+            #pragma omp parallel for
+            for (std::int64_t k = 0; k < static_cast<std::int64_t>(layer.size()); ++k) {
+                std::array<std::pair<label_type, std::size_t>, max_adjacent> prs;
+                std::size_t num_prs = 0;
+                for_each_nb(layer[k], [&](std::size_t nboff) {
+                    if (!is_donor(nboff))
+                        return;
+                    label_type nblbl = m_labels[nboff];
+                    std::size_t j = 0;
+                    while (j < num_prs && prs[j].first != nblbl)
+                        ++j;
+                    if (j == num_prs)
+                        prs[num_prs++] = { nblbl, 0 };
+                    ++prs[j].second;
+                });
+
+                // labels are numbered in the order the cells are stored, ties are broken by
+                // the grains of the labels so the outcome does not depend on the layout
+                auto best = prs[0];
+                for (std::size_t j = 1; j < num_prs; ++j) {
+                    auto& grs = m_grain_sets[prs[j].first];
+                    auto& best_grs = m_grain_sets[best.first];
+                    if (prs[j].second > best.second || (prs[j].second == best.second &&
+                            std::lexicographical_compare(grs.begin(), grs.end(), best_grs.begin(), best_grs.end())))
+                        best = prs[j];
+                }
+                new_labels[k] = best.first;
+            }
+
+            for (std::size_t k = 0; k < layer.size(); ++k) {
+                count_overflow(layer[k], num_grains(layer[k]), -1);
+                count_overflow(layer[k], num_grains_of(new_labels[k]), 1);
             }
-            m_cells[i] = const_cast<cell_type*>(prs.back().first);
+            std::size_t num_filled_nulls = 0;
+            #pragma omp parallel for reduction(+:num_filled_nulls)
+            for (std::int64_t k = 0; k < static_cast<std::int64_t>(layer.size()); ++k) {
+                std::size_t off = layer[k];
+                if (m_labels[off] == null_label)
+                    ++num_filled_nulls;
+                m_labels[off] = new_labels[k];
+                pending[off] = 0;
+            }
+            m_num_null_cells -= num_filled_nulls;
+            m_crysted_bits_synced = false;
+            for (std::size_t off : layer)
+                m_tiles.mark_dirty(m_tiles.tile_of(upos(off)));
+            num_pending -= layer.size();
+
+            layer = collect_offsets(layer.size(),
+                [&](std::size_t k, std::vector<std::size_t>& out) {
+                    for_each_nb(layer[k], [&](std::size_t nboff) {
+                        if (pending[nboff])
+                            out.push_back(nboff);
+                    });
+                });
         }
 
-        return success;
+        return num_pending == 0;
     }
 
     bool extrapolate_cells_with_numgrains_gt2() {
         return extrapolate_cells(
-            [this](std::size_t off) -> bool {
-                return m_cells[off] && m_cells[off]->grains.size() > 2;
+            [this](label_type lbl) -> bool {
+                return num_grains_of(lbl) > 2;
             });
     }
 
     bool extrapolate_nullcells() {
         return extrapolate_cells(
-            [this](std::size_t off) -> bool {
-                return !m_cells[off];
+            [](label_type lbl) -> bool {
+                return lbl == null_label;
             });
     }
 };
@@ -0,0 +1,290 @@
+// Copyright © 2020 Artyom Tokarev. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include "cgralgs.h"
+
+
+namespace cgr {
+
+// how clr_grains find the cells claimed by their fronts: by walking the stencil
+// of every front cell, by walking only the part of it not walked by a neighbouring
+// front cell or, for the von_neumann and moore neighbourhoods, by dilating
+// the front as a bitset
+enum class front_engine {
+    stencil,
+    shell,
+    bitset
+};
+
+
+// index of the lowest set bit, word != 0
+inline std::size_t lowest_bit(std::uint64_t word) {
+#if defined(_MSC_VER)
+    unsigned long res;
+    _BitScanForward64(&res, word);
+    return res;
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+
+// bit per cell of a grid in row-major order, x varies fastest
+class grid_bitset {
+public:
+    std::size_t size() const {
+        return m_size;
+    }
+    bool test(std::size_t i) const {
+        return (m_words[i >> 6] >> (i & 63)) & 1;
+    }
+    // bits [first, first + 64) in one word, the ones past the end are unset
+    std::uint64_t word_at(std::size_t first) const {
+        std::size_t w = first >> 6;
+        std::size_t t = first & 63;
+        std::uint64_t res = m_words[w] >> t;
+        if (t > 0 && w + 1 < m_words.size())
+            res |= m_words[w + 1] << (64 - t);
+        return res;
+    }
+
+    // safe against the other threads setting bits of the same word
+    void set_atomic(std::size_t i) {
+        std::uint64_t& word = m_words[i >> 6];
+        std::uint64_t bit = static_cast<std::uint64_t>(1) << (i & 63);
+        #pragma omp atomic
+        word |= bit;
+    }
+    // bit i = fn(i), words are filled in parallel
+    template <typename Fn>
+    void assign(std::size_t size, Fn fn) {
+        m_size = size;
+        m_words.assign((size + 63) / 64, 0);
+        #pragma omp parallel for
+        for (std::int64_t w = 0; w < static_cast<std::int64_t>(size + 63) / 64; ++w) {
+            std::size_t end = std::min<std::size_t>((w + 1) * 64, size);
+            std::uint64_t word = 0;
+            for (std::size_t i = w * 64; i < end; ++i)
+                if (fn(i))
+                    word |= static_cast<std::uint64_t>(1) << (i & 63);
+            m_words[w] = word;
+        }
+    }
+    void clear() {
+        m_size = 0;
+        m_words.clear();
+        m_words.shrink_to_fit();
+    }
+
+
+private:
+    std::size_t m_size = 0;
+    std::vector<std::uint64_t> m_words;
+};
+
+
+// bits of the cells of a box in row-major order, each row along x is padded
+// to whole words with the padding bits kept unset. dilations are by the chebyshev
+// and taxicab balls, bits leaving the box are dropped, which does not change
+// the bits inside since the balls are convex
+template <std::size_t Dim>
+class box_bitset {
+public:
+    const pos_t<Dim>& min_corner() const {
+        return m_min_corner;
+    }
+    const upos_t<Dim>& lens() const {
+        return m_lens;
+    }
+    std::size_t row_words() const {
+        return m_row_words;
+    }
+    std::size_t num_rows() const {
+        return m_num_rows;
+    }
+    const std::uint64_t* row(std::size_t r) const {
+        return m_words.data() + r * m_row_words;
+    }
+
+    // position of the first cell of row r
+    pos_t<Dim> row_pos(std::size_t r) const {
+        pos_t<Dim> res = m_min_corner;
+        for (std::size_t i = 1; i < Dim; ++i) {
+            res[i] += r % m_lens[i];
+            r /= m_lens[i];
+        }
+        return res;
+    }
+
+    // pos is relative to the min corner
+    void set(const upos_t<Dim>& pos) {
+        std::size_t r = 0;
+        for (std::size_t i = Dim - 1; i > 0; --i)
+            r = r * m_lens[i] + pos[i];
+        m_words[r * m_row_words + (pos[0] >> 6)] |= static_cast<std::uint64_t>(1) << (pos[0] & 63);
+    }
+
+    // all bits unset, storage is reused
+    void reset(const pos_t<Dim>& mincorner, const upos_t<Dim>& lens) {
+        m_min_corner = mincorner;
+        m_lens = lens;
+        m_row_words = (lens[0] + 63) / 64;
+        m_num_rows = 1;
+        for (std::size_t i = 1; i < Dim; ++i)
+            m_num_rows *= lens[i];
+        m_words.assign(m_row_words * m_num_rows, 0);
+    }
+
+    // the chebyshev ball is the product of segments, so the axes are dilated one by one.
+    // a segment [-c, c] dilated by {-m, 0, m} gives [-c - m, c + m] for m <= 2c + 1,
+    // the radius grows in O(log(r)) steps
+    void dilate_box(std::size_t r) {
+        for (std::size_t k = 0; k < Dim; ++k) {
+            for (std::size_t c = 0; c < r;) {
+                std::size_t m = std::min(2 * c + 1, r - c);
+                m_buf = m_words;
+                or_shifted(k, static_cast<std::int64_t>(m));
+                or_shifted(k, -static_cast<std::int64_t>(m));
+                m_words.swap(m_buf);
+                c += m;
+            }
+        }
+    }
+
+    // the taxicab ball of radius r is r unit crosses summed
+    void dilate_diamond(std::size_t r) {
+        for (std::size_t c = 0; c < r; ++c) {
+            m_buf = m_words;
+            for (std::size_t k = 0; k < Dim; ++k) {
+                or_shifted(k, 1);
+                or_shifted(k, -1);
+            }
+            m_words.swap(m_buf);
+        }
+    }
+
+
+private:
+    pos_t<Dim> m_min_corner;
+    upos_t<Dim> m_lens;
+    std::size_t m_row_words = 0;
+    std::size_t m_num_rows = 0;
+    std::vector<std::uint64_t> m_words;
+    std::vector<std::uint64_t> m_buf;
+
+    // m_buf |= m_words shifted by s cells along axis k
+    void or_shifted(std::size_t k, std::int64_t s) {
+        if (k == 0) {
+            std::size_t q = std::abs(s) >> 6;
+            std::size_t t = std::abs(s) & 63;
+            if (q >= m_row_words)
+                return;
+            std::size_t tail = m_lens[0] & 63;
+            std::uint64_t tail_mask = tail ? (static_cast<std::uint64_t>(1) << tail) - 1 : ~static_cast<std::uint64_t>(0);
+            for (std::size_t r = 0; r < m_num_rows; ++r) {
+                const std::uint64_t* src = m_words.data() + r * m_row_words;
+                std::uint64_t* dst = m_buf.data() + r * m_row_words;
+                if (s > 0) {
+                    for (std::size_t w = q; w < m_row_words; ++w) {
+                        std::uint64_t v = src[w - q] << t;
+                        if (t > 0 && w > q)
+                            v |= src[w - q - 1] >> (64 - t);
+                        dst[w] |= v;
+                    }
+                    dst[m_row_words - 1] &= tail_mask;
+                } else {
+                    for (std::size_t w = 0; w + q < m_row_words; ++w) {
+                        std::uint64_t v = src[w + q] >> t;
+                        if (t > 0 && w + q + 1 < m_row_words)
+                            v |= src[w + q + 1] << (64 - t);
+                        dst[w] |= v;
+                    }
+                }
+            }
+            return;
+        }
+
+        std::size_t rowstride = 1;
+        for (std::size_t i = 1; i < k; ++i)
+            rowstride *= m_lens[i];
+        std::int64_t len = m_lens[k];
+        for (std::size_t r = 0; r < m_num_rows; ++r) {
+            std::int64_t c = (r / rowstride) % m_lens[k];
+            if (c - s < 0 || c - s >= len)
+                continue;
+            const std::uint64_t* src = m_words.data() + (r - s * static_cast<std::int64_t>(rowstride)) * m_row_words;
+            std::uint64_t* dst = m_buf.data() + r * m_row_words;
+            for (std::size_t w = 0; w < m_row_words; ++w)
+                dst[w] |= src[w];
+        }
+    }
+};
+
+
+// bit per cell of a box in row-major order, all unset between the uses, so the box
+// is reshaped without clearing it. the storage is kept for the next boxes and given
+// back when it is four times the box
+template <std::size_t Dim>
+class box_marks {
+public:
+    const pos_t<Dim>& min_corner() const {
+        return m_min_corner;
+    }
+    // index of the cell at pos relative to the min corner
+    std::size_t index(const upos_t<Dim>& pos) const {
+        std::size_t res = 0;
+        for (std::size_t i = 0; i < Dim; ++i)
+            res += pos[i] * m_strides[i];
+        return res;
+    }
+    // index delta of a shift
+    template <typename Coord>
+    std::int64_t delta(const pos_t<Dim, Coord>& sh) const {
+        std::int64_t res = 0;
+        for (std::size_t i = 0; i < Dim; ++i)
+            res += static_cast<std::int64_t>(sh[i]) * static_cast<std::int64_t>(m_strides[i]);
+        return res;
+    }
+
+    bool test(std::size_t i) const {
+        return (m_words[i >> 6] >> (i & 63)) & 1;
+    }
+    void set(std::size_t i) {
+        m_words[i >> 6] |= static_cast<std::uint64_t>(1) << (i & 63);
+    }
+    // unsets the word of bit i
+    void unset_word(std::size_t i) {
+        m_words[i >> 6] = 0;
+    }
+
+    void reshape(const pos_t<Dim>& mincorner, const upos_t<Dim>& lens) {
+        m_min_corner = mincorner;
+        std::size_t size = 1;
+        for (std::size_t i = 0; i < Dim; ++i) {
+            m_strides[i] = size;
+            size *= lens[i];
+        }
+        std::size_t num_words = (size + 63) / 64;
+        if (m_words.size() < num_words)
+            m_words.resize(num_words, 0);
+        else if (m_words.size() / 4 > num_words)
+            std::vector<std::uint64_t>(num_words, 0).swap(m_words);
+    }
+
+
+private:
+    pos_t<Dim> m_min_corner;
+    upos_t<Dim> m_strides;
+    std::vector<std::uint64_t> m_words;
+};
+
+} // namespace cgr
@@ -0,0 +1,146 @@
+// Copyright © 2020 Artyom Tokarev. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include "cgralgs.h"
+
+
+namespace cgr {
+
+// uniform grid of cubic buckets over the domain holding indices of points
+template <std::size_t Dim>
+class bucket_grid {
+public:
+    std::size_t bucket_side() const {
+        return m_side;
+    }
+    std::size_t num_points() const {
+        return m_items.size();
+    }
+
+    // visits every point of the buckets ring by ring (chebyshev rings in bucket units) around pos.
+    // after each ring stop(lb) is called with a lower bound of the chebyshev distance
+    // from pos to each point not visited yet, the search ends when it returns true
+    template <typename VisitFn, typename StopFn>
+    void visit_rings(const upos_t<Dim>& pos, VisitFn visit, StopFn stop) const {
+        upos_t<Dim> center;
+        for (std::size_t i = 0; i < Dim; ++i)
+            center[i] = pos[i] / m_side;
+
+        for (std::size_t ring = 0;; ++ring) {
+            visit_ring(center, ring, visit);
+
+            std::size_t lb = std::numeric_limits<std::size_t>::max();
+            for (std::size_t i = 0; i < Dim; ++i) {
+                if (center[i] > ring)
+                    lb = std::min(lb, pos[i] - (center[i] - ring) * m_side + 1);
+                if (center[i] + ring + 1 < m_num_buckets[i])
+                    lb = std::min(lb, (center[i] + ring + 1) * m_side - pos[i]);
+            }
+            if (lb == std::numeric_limits<std::size_t>::max() || stop(lb))
+                return;
+        }
+    }
+
+    bucket_grid(const upos_t<Dim>& dimlens, const std::vector<upos_t<Dim>>& points, std::size_t points_per_bucket = 2) {
+        std::size_t num_cells = 1;
+        for (auto e : dimlens.x)
+            num_cells *= e;
+        double bucket_volume = static_cast<double>(num_cells) * points_per_bucket / std::max<std::size_t>(points.size(), 1);
+        m_side = std::max<std::size_t>(1, static_cast<std::size_t>(std::pow(bucket_volume, 1.0 / Dim)));
+
+        std::size_t total_buckets = 1;
+        for (std::size_t i = 0; i < Dim; ++i) {
+            m_num_buckets[i] = (dimlens[i] + m_side - 1) / m_side;
+            total_buckets *= m_num_buckets[i];
+        }
+
+        // counting sort of points by bucket
+        m_starts.assign(total_buckets + 1, 0);
+        for (auto& p : points)
+            ++m_starts[bucket_of(p) + 1];
+        for (std::size_t i = 0; i < total_buckets; ++i)
+            m_starts[i + 1] += m_starts[i];
+        m_items.resize(points.size());
+        std::vector<std::size_t> fill(m_starts.begin(), m_starts.end() - 1);
+        for (std::size_t i = 0; i < points.size(); ++i)
+            m_items[fill[bucket_of(points[i])]++] = i;
+    }
+
+
+private:
+    std::size_t m_side = 1;
+    upos_t<Dim> m_num_buckets;
+    std::vector<std::size_t> m_starts;
+    std::vector<std::size_t> m_items;
+
+    std::size_t bucket_of(const upos_t<Dim>& p) const {
+        std::size_t res = 0;
+        std::size_t mul = 1;
+        for (std::size_t i = 0; i < Dim; ++i) {
+            res += p[i] / m_side * mul;
+            mul *= m_num_buckets[i];
+        }
+        return res;
+    }
+
+    template <typename VisitFn>
+    void visit_bucket(std::size_t bucket, VisitFn& visit) const {
+        for (std::size_t i = m_starts[bucket]; i < m_starts[bucket + 1]; ++i)
+            visit(m_items[i]);
+    }
+
+    // visits buckets whose chebyshev distance to center is exactly ring
+    template <typename VisitFn>
+    void visit_ring(const upos_t<Dim>& center, std::size_t ring, VisitFn& visit) const {
+        std::int64_t sring = ring;
+        pos_t<Dim> lo, hi;
+        for (std::size_t i = 0; i < Dim; ++i) {
+            lo[i] = std::max<std::int64_t>(0, static_cast<std::int64_t>(center[i]) - sring);
+            hi[i] = std::min<std::int64_t>(m_num_buckets[i] - 1, static_cast<std::int64_t>(center[i]) + sring);
+        }
+
+        pos_t<Dim> cur = lo;
+        while (true) {
+            bool on_ring = false;
+            for (std::size_t i = 1; i < Dim; ++i)
+                if (std::abs(cur[i] - static_cast<std::int64_t>(center[i])) == sring)
+                    on_ring = true;
+
+            std::size_t row = 0;
+            std::size_t mul = m_num_buckets[0];
+            for (std::size_t i = 1; i < Dim; ++i) {
+                row += cur[i] * mul;
+                mul *= m_num_buckets[i];
+            }
+            if (on_ring || ring == 0) {
+                for (std::int64_t x = lo[0]; x <= hi[0]; ++x)
+                    visit_bucket(row + x, visit);
+            } else {
+                std::int64_t x0 = static_cast<std::int64_t>(center[0]) - sring;
+                std::int64_t x1 = static_cast<std::int64_t>(center[0]) + sring;
+                if (x0 >= 0)
+                    visit_bucket(row + x0, visit);
+                if (x1 < static_cast<std::int64_t>(m_num_buckets[0]))
+                    visit_bucket(row + x1, visit);
+            }
+
+            std::size_t i = 1;
+            for (; i < Dim; ++i) {
+                if (++cur[i] <= hi[i])
+                    break;
+                cur[i] = lo[i];
+            }
+            if (i == Dim)
+                return;
+        }
+    }
+};
+
+} // namespace cgr
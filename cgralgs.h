@@ -2,16 +2,23 @@
 // Licensed under the MIT License.
 
 #pragma once
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
 #include "vec.h"
 #include "mat.h"
+#include "sptops.h"
 
 
 namespace cgr {
 
-template <std::size_t Dim>
-using pos_t = spt::veci<Dim>;
-template <std::size_t Dim>
-using upos_t = spt::vecu<Dim>;
+template <std::size_t Dim, typename Coord = std::int64_t>
+using pos_t = spt::vec<Dim, Coord>;
+template <std::size_t Dim, typename UCoord = std::uint64_t>
+using upos_t = spt::vec<Dim, UCoord>;
 
 template <std::size_t Dim, typename Real = double>
 using orientation_t = spt::mat<Dim, Real>; // |each vec| == 1
@@ -100,6 +107,53 @@ norm_fn<Dim> make_norm_cryst_fn(std::vector<grow_dir_t<Dim, ValueType>> growdirs
     };
 }
 
+// lower bound of norm_cryst(pos) / norm_chebyshev(pos) over nonzero pos,
+// zero when the grow directions do not span the space
+template <std::size_t Dim, typename ValueType>
+ValueType norm_cryst_chebyshev_ratio(const std::vector<grow_dir_t<Dim, ValueType>>& growdirs) {
+    // for a basis u_i = gd_i / (gd_i, gd_i) out of the grow directions
+    // max_i |(pos, u_i)| = |U pos|_inf >= |pos|_inf / |U^-1|_inf
+    ValueType res = 0;
+    auto try_basis = [&growdirs, &res](const std::array<std::size_t, Dim>& idxs) {
+        spt::mat<Dim, ValueType> u;
+        for (std::size_t i = 0; i < Dim; ++i)
+            u[i] = growdirs[idxs[i]] / spt::dot(growdirs[idxs[i]], growdirs[idxs[i]]);
+
+        ValueType det;
+        if constexpr (Dim == 2)
+            det = spt::cross(u[0], u[1]);
+        else
+            det = spt::mixed(u[0], u[1], u[2]);
+        if (std::abs(det) < static_cast<ValueType>(1e-9))
+            return;
+
+        auto inv = u.inversed();
+        ValueType inv_norm = 0;
+        for (std::size_t i = 0; i < Dim; ++i) {
+            ValueType row_sum = 0;
+            for (std::size_t j = 0; j < Dim; ++j)
+                row_sum += std::abs(inv[i][j]);
+            inv_norm = std::max(inv_norm, row_sum);
+        }
+        res = std::max(res, 1 / inv_norm);
+    };
+
+    std::size_t n = growdirs.size();
+    if constexpr (Dim == 2) {
+        for (std::size_t i = 0; i < n; ++i)
+            for (std::size_t j = i + 1; j < n; ++j)
+                try_basis({ i, j });
+    } else {
+        for (std::size_t i = 0; i < n; ++i)
+            for (std::size_t j = i + 1; j < n; ++j)
+                for (std::size_t k = j + 1; k < n; ++k)
+                    try_basis({ i, j, k });
+    }
+
+    // margin for the rounding of the norm itself
+    return res * static_cast<ValueType>(1 - 1e-6);
+}
+
 template <std::size_t Dim>
 std::size_t norm_taxicab(const pos_t<Dim>& pos) {
     std::int64_t sum_abs = 0;
@@ -134,4 +188,261 @@ std::size_t norm2_euclid(const pos_t<Dim>& pos) {
     return static_cast<std::size_t>(pos.magnitude2());
 }
 
+// positions that are the least or the greatest on their line along every axis,
+// every vertex of the convex hull is among them
+template <std::size_t Dim>
+std::vector<pos_t<Dim>> extreme_on_lines(std::vector<pos_t<Dim>> poses) {
+    std::sort(poses.begin(), poses.end(), [](const pos_t<Dim>& l, const pos_t<Dim>& r) -> bool {
+        return l.x < r.x;
+    });
+    poses.erase(std::unique(poses.begin(), poses.end()), poses.end());
+
+    std::vector<std::size_t> num_extreme(poses.size(), 0);
+    std::vector<std::size_t> idxs(poses.size());
+    for (std::size_t k = 0; k < Dim; ++k) {
+        for (std::size_t i = 0; i < idxs.size(); ++i)
+            idxs[i] = i;
+        auto same_line = [&poses, k](std::size_t l, std::size_t r) -> bool {
+            for (std::size_t j = 0; j < Dim; ++j)
+                if (j != k && poses[l][j] != poses[r][j])
+                    return false;
+            return true;
+        };
+        std::sort(idxs.begin(), idxs.end(), [&poses, k](std::size_t l, std::size_t r) -> bool {
+            for (std::size_t j = 0; j < Dim; ++j)
+                if (j != k && poses[l][j] != poses[r][j])
+                    return poses[l][j] < poses[r][j];
+            return poses[l][k] < poses[r][k];
+        });
+
+        for (std::size_t beg = 0, end = 0; beg < idxs.size(); beg = end) {
+            while (end < idxs.size() && same_line(idxs[beg], idxs[end]))
+                ++end;
+            ++num_extreme[idxs[beg]];
+            if (end - 1 != beg)
+                ++num_extreme[idxs[end - 1]];
+        }
+    }
+
+    std::vector<pos_t<Dim>> res;
+    for (std::size_t i = 0; i < poses.size(); ++i)
+        if (num_extreme[i] == Dim)
+            res.push_back(poses[i]);
+    return res;
+}
+
+// vertices of the convex hull counterclockwise by the monotone chain
+inline std::vector<pos_t<2>> convex_hull(std::vector<pos_t<2>> poses) {
+    std::sort(poses.begin(), poses.end(), [](const pos_t<2>& l, const pos_t<2>& r) -> bool {
+        return l[0] < r[0] || (l[0] == r[0] && l[1] < r[1]);
+    });
+    poses.erase(std::unique(poses.begin(), poses.end()), poses.end());
+    if (poses.size() < 3)
+        return poses;
+
+    auto cross = [](const pos_t<2>& o, const pos_t<2>& a, const pos_t<2>& b) -> std::int64_t {
+        return (a[0] - o[0]) * (b[1] - o[1]) - (a[1] - o[1]) * (b[0] - o[0]);
+    };
+    std::vector<pos_t<2>> res(2 * poses.size());
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < poses.size(); ++i) {
+        while (n >= 2 && cross(res[n - 2], res[n - 1], poses[i]) <= 0)
+            --n;
+        res[n++] = poses[i];
+    }
+    for (std::size_t i = poses.size() - 1, lower_n = n + 1; i-- > 0;) {
+        while (n >= lower_n && cross(res[n - 2], res[n - 1], poses[i]) <= 0)
+            --n;
+        res[n++] = poses[i];
+    }
+    res.resize(n - 1);
+    return res;
+}
+
+// vertices of the convex hull by quickhull in exact integer arithmetic, positions lying
+// on a face may be among them. coplanar positions are reduced to the 2D hull of their
+// projection onto the plane of the two axes the normal is least along
+inline std::vector<pos_t<3>> convex_hull(std::vector<pos_t<3>> poses) {
+    std::sort(poses.begin(), poses.end(), [](const pos_t<3>& l, const pos_t<3>& r) -> bool {
+        return l.x < r.x;
+    });
+    poses.erase(std::unique(poses.begin(), poses.end()), poses.end());
+    if (poses.size() < 4)
+        return poses;
+
+    // > 0 if p is on the side of the plane of abc its normal (b - a) x (c - a) points to
+    auto side = [&poses](std::size_t a, std::size_t b, std::size_t c, std::size_t p) -> std::int64_t {
+        return spt::mixed(poses[b] - poses[a], poses[c] - poses[a], poses[p] - poses[a]);
+    };
+
+    // the first position is the least, so it is a vertex, the farthest from it is another one
+    std::size_t n = poses.size();
+    std::array<std::size_t, 4> simplex{ 0, 0, 0, 0 };
+    std::int64_t best = 0;
+    for (std::size_t i = 1; i < n; ++i)
+        if (auto d = (poses[i] - poses[0]).magnitude2(); d > best) {
+            best = d;
+            simplex[1] = i;
+        }
+    best = 0;
+    for (std::size_t i = 1; i < n; ++i)
+        if (auto d = spt::cross(poses[simplex[1]] - poses[0], poses[i] - poses[0]).magnitude2(); d > best) {
+            best = d;
+            simplex[2] = i;
+        }
+    if (best == 0)
+        return { poses[0], poses[simplex[1]] };
+    best = 0;
+    for (std::size_t i = 1; i < n; ++i)
+        if (auto d = std::abs(side(0, simplex[1], simplex[2], i)); d > best) {
+            best = d;
+            simplex[3] = i;
+        }
+    if (best == 0) {
+        auto normal = spt::cross(poses[simplex[1]] - poses[0], poses[simplex[2]] - poses[0]);
+        std::size_t drop = 0;
+        for (std::size_t k = 1; k < 3; ++k)
+            if (std::abs(normal[k]) > std::abs(normal[drop]))
+                drop = k;
+        auto project = [drop](const pos_t<3>& pos) -> pos_t<2> {
+            return pos_t<2>({ pos[(drop + 1) % 3], pos[(drop + 2) % 3] });
+        };
+        auto less = [](const pos_t<2>& l, const pos_t<2>& r) -> bool {
+            return l.x < r.x;
+        };
+        std::vector<pos_t<2>> projs;
+        projs.reserve(n);
+        for (auto& pos : poses)
+            projs.push_back(project(pos));
+        auto hull = convex_hull(std::move(projs));
+        std::sort(hull.begin(), hull.end(), less);
+        std::vector<pos_t<3>> res;
+        for (auto& pos : poses)
+            if (std::binary_search(hull.begin(), hull.end(), project(pos), less))
+                res.push_back(pos);
+        return res;
+    }
+
+    // faces are oriented with the normal outwards, the face of a directed edge
+    // is looked up by the key of the edge, the face across it by the reversed one
+    struct face {
+        std::array<std::size_t, 3> v;
+        std::vector<std::size_t> outside;
+        bool alive = true;
+    };
+    std::vector<face> faces;
+    std::unordered_map<std::size_t, std::size_t> edge_faces;
+    auto edge_key = [n](std::size_t u, std::size_t v) -> std::size_t {
+        return u * n + v;
+    };
+    auto add_face = [&](std::size_t a, std::size_t b, std::size_t c) -> std::size_t {
+        faces.push_back({ { a, b, c }, {} });
+        for (std::size_t k = 0; k < 3; ++k)
+            edge_faces[edge_key(faces.back().v[k], faces.back().v[(k + 1) % 3])] = faces.size() - 1;
+        return faces.size() - 1;
+    };
+    // points outside of a face of the given ones go to the first of them
+    auto assign = [&](const std::vector<std::size_t>& pts, const std::vector<std::size_t>& fcs) {
+        for (auto p : pts) {
+            for (auto f : fcs) {
+                auto& v = faces[f].v;
+                if (side(v[0], v[1], v[2], p) > 0) {
+                    faces[f].outside.push_back(p);
+                    break;
+                }
+            }
+        }
+    };
+
+    if (side(simplex[0], simplex[1], simplex[2], simplex[3]) > 0)
+        std::swap(simplex[1], simplex[2]);
+    std::vector<std::size_t> new_faces{
+        add_face(simplex[0], simplex[1], simplex[2]), add_face(simplex[0], simplex[3], simplex[1]),
+        add_face(simplex[1], simplex[3], simplex[2]), add_face(simplex[2], simplex[3], simplex[0]) };
+    std::vector<std::size_t> rest;
+    for (std::size_t i = 0; i < n; ++i)
+        if (std::find(simplex.begin(), simplex.end(), i) == simplex.end())
+            rest.push_back(i);
+    assign(rest, new_faces);
+
+    std::vector<std::size_t> visible;
+    std::vector<std::pair<std::size_t, std::size_t>> horizon;
+    // faces once seen stay marked, they are dead and never reached again
+    std::vector<std::uint8_t> is_visible;
+    for (std::size_t f = 0; f < faces.size(); ++f) {
+        if (!faces[f].alive || faces[f].outside.empty())
+            continue;
+
+        std::size_t eye = faces[f].outside[0];
+        std::int64_t eye_side = 0;
+        for (auto p : faces[f].outside) {
+            auto& v = faces[f].v;
+            if (auto s = side(v[0], v[1], v[2], p); s > eye_side) {
+                eye_side = s;
+                eye = p;
+            }
+        }
+
+        // faces the eye sees are connected, the edges between them and the rest form the horizon
+        is_visible.resize(faces.size(), 0);
+        visible.assign(1, f);
+        is_visible[f] = 1;
+        horizon.clear();
+        for (std::size_t k = 0; k < visible.size(); ++k) {
+            auto v = faces[visible[k]].v;
+            for (std::size_t e = 0; e < 3; ++e) {
+                std::size_t nb = edge_faces[edge_key(v[(e + 1) % 3], v[e])];
+                if (is_visible[nb])
+                    continue;
+                auto& nbv = faces[nb].v;
+                if (side(nbv[0], nbv[1], nbv[2], eye) > 0) {
+                    is_visible[nb] = 1;
+                    visible.push_back(nb);
+                } else {
+                    horizon.push_back({ v[e], v[(e + 1) % 3] });
+                }
+            }
+        }
+
+        rest.clear();
+        for (auto vf : visible) {
+            faces[vf].alive = false;
+            for (auto p : faces[vf].outside)
+                if (p != eye)
+                    rest.push_back(p);
+            faces[vf].outside = {};
+        }
+        new_faces.clear();
+        for (auto [u, v] : horizon)
+            new_faces.push_back(add_face(u, v, eye));
+        assign(rest, new_faces);
+    }
+
+    std::vector<std::uint8_t> is_vertex(n, 0);
+    for (auto& fc : faces)
+        if (fc.alive)
+            for (auto v : fc.v)
+                is_vertex[v] = 1;
+    std::vector<pos_t<3>> res;
+    for (std::size_t i = 0; i < n; ++i)
+        if (is_vertex[i])
+            res.push_back(poses[i]);
+    return res;
+}
+
+// squared diameter of the positions measured over the pairs of the vertices
+// of their convex hull in 2D and 3D, of the positions extreme on their lines otherwise
+template <std::size_t Dim>
+std::int64_t diam2(std::vector<pos_t<Dim>> poses) {
+    auto cands = extreme_on_lines<Dim>(std::move(poses));
+    if constexpr (Dim == 2 || Dim == 3)
+        cands = convex_hull(std::move(cands));
+
+    std::int64_t res = 0;
+    for (std::size_t i = 0; i < cands.size(); ++i)
+        for (std::size_t j = i + 1; j < cands.size(); ++j)
+            res = std::max(res, (cands[j] - cands[i]).magnitude2());
+    return res;
+}
+
 } // namespace cgr
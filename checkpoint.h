@@ -0,0 +1,158 @@
+// Copyright © 2020 Artyom Tokarev. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include "grain.h"
+#include "material.h"
+
+
+namespace cgr {
+
+// 64-bit FNV-1a, hash continues the hash of the preceding bytes
+inline std::uint64_t fnv1a(const void* data, std::size_t size,
+                           std::uint64_t hash = 0xcbf29ce484222325) {
+    auto bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+
+// a checkpoint is a sequence of chunks, each one is its byte count (uint32),
+// the checksum of its bytes (uint64) and the bytes, an empty chunk ends it.
+// values are written in the byte order of the machine, the header of the
+// automata tells it
+class chunk_writer {
+public:
+    static constexpr std::size_t chunk_size = 1 << 20;
+
+    template <typename T>
+    void put(const T& val) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        put_bytes(&val, sizeof(T));
+    }
+    void put_bytes(const void* data, std::size_t size) {
+        auto bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            std::size_t n = std::min(size, chunk_size - m_buf.size());
+            m_buf.insert(m_buf.end(), bytes, bytes + n);
+            bytes += n;
+            size -= n;
+            if (m_buf.size() == chunk_size)
+                flush();
+        }
+    }
+
+    // the last chunk and the end mark
+    void finish() {
+        flush();
+        write_chunk(nullptr, 0);
+        if (!m_os)
+            throw std::runtime_error("cgr::chunk_writer: write failed");
+    }
+
+    chunk_writer(std::ostream& os) : m_os{ os } {
+        m_buf.reserve(chunk_size);
+    }
+
+
+private:
+    std::ostream& m_os;
+    std::vector<char> m_buf;
+
+    void flush() {
+        if (m_buf.empty())
+            return;
+        write_chunk(m_buf.data(), m_buf.size());
+        m_buf.clear();
+    }
+
+    void write_chunk(const char* data, std::size_t size) {
+        auto usize = static_cast<std::uint32_t>(size);
+        std::uint64_t sum = fnv1a(data, size);
+        m_os.write(reinterpret_cast<const char*>(&usize), sizeof(usize));
+        m_os.write(reinterpret_cast<const char*>(&sum), sizeof(sum));
+        m_os.write(data, size);
+        if (!m_os)
+            throw std::runtime_error("cgr::chunk_writer: write failed");
+    }
+};
+
+
+// reads what chunk_writer wrote, every chunk is verified before its bytes are given out
+class chunk_reader {
+public:
+    template <typename T>
+    T get() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T res;
+        get_bytes(&res, sizeof(T));
+        return res;
+    }
+    void get_bytes(void* data, std::size_t size) {
+        auto bytes = static_cast<char*>(data);
+        while (size > 0) {
+            if (m_pos == m_buf.size() && !read_chunk())
+                throw std::runtime_error("cgr::chunk_reader: unexpected end of checkpoint");
+            std::size_t n = std::min(size, m_buf.size() - m_pos);
+            std::memcpy(bytes, m_buf.data() + m_pos, n);
+            m_pos += n;
+            bytes += n;
+            size -= n;
+        }
+    }
+
+    // throws unless the end mark follows the bytes read
+    void finish() {
+        if (m_pos != m_buf.size() || read_chunk())
+            throw std::runtime_error("cgr::chunk_reader: trailing bytes in checkpoint");
+    }
+
+    chunk_reader(std::istream& is) : m_is{ is } {}
+
+
+private:
+    std::istream& m_is;
+    std::vector<char> m_buf;
+    std::size_t m_pos = 0;
+
+    // false on the end mark
+    bool read_chunk() {
+        std::uint32_t size;
+        std::uint64_t sum;
+        m_is.read(reinterpret_cast<char*>(&size), sizeof(size));
+        m_is.read(reinterpret_cast<char*>(&sum), sizeof(sum));
+        if (!m_is || size > chunk_writer::chunk_size)
+            throw std::runtime_error("cgr::chunk_reader: corrupted chunk header");
+        m_buf.resize(size);
+        m_pos = 0;
+        m_is.read(m_buf.data(), size);
+        if (!m_is)
+            throw std::runtime_error("cgr::chunk_reader: unexpected end of checkpoint");
+        if (fnv1a(m_buf.data(), size) != sum)
+            throw std::runtime_error("cgr::chunk_reader: checksum mismatch");
+        return size > 0;
+    }
+};
+
+
+// materials and grains restored from a checkpoint, the restored automata points
+// into them, so the pool must outlive it and must not be changed
+template <std::size_t Dim, typename Real = double>
+struct grain_pool {
+    std::vector<material<Dim, Real>> materials;
+    std::vector<grain<Dim, Real>> grains;
+};
+
+} // namespace cgr
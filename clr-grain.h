@@ -2,19 +2,34 @@
 // Licensed under the MIT License.
 
 #pragma once
+#include <cstdint>
 #include <optional>
+#include <memory>
+#include <vector>
+#include <algorithm>
 #include "grain.h"
 #include "neighborhood.h"
-#include <unordered_set>
+#include "layout.h"
+#include "stencil.h"
+#include "norms.h"
+#include "bit-front.h"
 
 
 namespace cgr {
 
-// clr means cellular
-template <std::size_t Dim, typename Real = double>
+// clr means cellular, offsets are in the order of Layout.
+// the grain grows by Norm, any_norm picks one of the norms at runtime.
+// the front is stored as Offset and the stencil shifts as Coord coordinates
+template <std::size_t Dim, typename Real = double, typename Layout = linear_layout<Dim>,
+          typename Norm = any_norm<Dim, Real>, typename Coord = std::int64_t, typename Offset = std::size_t>
 class clr_grain {
 public:
     using grain_type = cgr::grain<Dim, Real>;
+    using norm_type = Norm;
+    using coord_type = Coord;
+    using offset_type = Offset;
+    using stencil_cache_type = stencil_cache<Dim, Real, Layout, Coord, Offset>;
+    using stencil_type = typename stencil_cache_type::stencil_type;
 
     const grain_type* grain() const {
         return m_grain;
@@ -22,8 +37,19 @@ public:
     upos_t<Dim> center() const {
         return m_center;
     }
+    nbh::nbhood_kind kind() const {
+        return m_kind;
+    }
     std::size_t norm(const pos_t<Dim>& pos) const {
-        return m_normfn(pos);
+        return m_norm(pos);
+    }
+    // res[i] = norm of the i-th position
+    void norms(const pos_batch<Dim, Real>& poses, std::size_t* res) const {
+        eval_norms<Dim, Real>(m_norm, poses, res);
+    }
+    // norm(pos) >= floor(min_norm_ratio() * norm_chebyshev(pos))
+    Real min_norm_ratio() const {
+        return m_min_norm_ratio;
     }
 
     std::size_t range() const {
@@ -31,13 +57,29 @@ public:
     }
     void set_range(std::size_t range) {
         m_range = range;
-        m_bbox_range = range * 2;
-        m_shifts = nbh::make_shifts<Dim>(m_normfn, m_range, m_bbox_range);
+        m_stencil = visit_norm(m_norm, [this](const auto& norm) {
+            return m_stencils->get({ m_kind, m_norm_dirs, m_range, m_range * 2 }, norm);
+        });
     }
 
-    const std::vector<std::size_t>& front() const {
+    const std::vector<offset_type>& front() const {
         return m_front;
     }
+    // bbox of the front, the cells claimed by the last advance until the front is thinned.
+    // the grain is active while its front is not empty
+    const upos_t<Dim>& front_min_corner() const {
+        return m_front_min_corner;
+    }
+    const upos_t<Dim>& front_max_corner() const {
+        return m_front_max_corner;
+    }
+    bool active() const {
+        return !m_front.empty();
+    }
+    // the neighbourhood is a chebyshev or taxicab ball, see advance_front_bits()
+    bool dilatable() const {
+        return m_kind == nbh::nbhood_kind::moore || m_kind == nbh::nbhood_kind::von_neumann;
+    }
 
     void front_swap_remove(std::size_t idx) {
         std::swap(m_front[idx], m_front.back());
@@ -46,73 +88,189 @@ public:
 
     template <typename CrystedFn, typename NumGrainsFn>
     void advance_front(CrystedFn crysted, NumGrainsFn numgrs) {
-        for (std::size_t i = 0; i < m_front.size();) {
-            if (numgrs(m_front[i]) > 1)
-                front_swap_remove(i);
+        remove_shared_front(numgrs);
+
+        // duplicates are told by the marks of the thread over the cells the front
+        // may claim, they are unset afterwards so the buffers are reused from call
+        // to call without clearing or reallocating
+        auto& marks = front_marks(m_stencil->bbox_range);
+        m_next_front.clear();
+        for (std::size_t off : m_front) {
+            std::size_t base = marks_index(marks, off);
+            for_each_nb(off, *m_stencil, [&](std::size_t o, const auto& sh) -> bool {
+                std::size_t m = base + marks.delta(sh);
+                if (!marks.test(m) && !crysted(o)) {
+                    marks.set(m);
+                    m_next_front.push_back(static_cast<offset_type>(o));
+                }
+                return true;
+            });
+        }
+        for (offset_type o : m_next_front)
+            marks.unset_word(marks_index(marks, o));
+        std::sort(m_next_front.begin(), m_next_front.end());
+        m_front.swap(m_next_front);
+        update_front_bbox();
+    }
+
+    // same front as advance_front(). a front cell whose neighbour preceding it in row-major
+    // order is in the front too visits only the shell of its stencil beyond the stencil
+    // of that neighbour, the rest is visited along the chain of such neighbours
+    // by the first one of it. a cell without one visits the whole stencil.
+    // front cells are marked too, they are told from the next front ones as crysted
+    template <typename CrystedFn, typename NumGrainsFn>
+    void advance_front_shells(CrystedFn crysted, NumGrainsFn numgrs) {
+        remove_shared_front(numgrs);
+
+        auto& marks = front_marks(m_stencil->bbox_range);
+        for (offset_type off : m_front)
+            marks.set(marks_index(marks, off));
+
+        m_next_front.clear();
+        std::size_t base = 0;
+        auto claim = [&](std::size_t o, const auto& sh) -> bool {
+            std::size_t m = base + marks.delta(sh);
+            if (!marks.test(m) && !crysted(o)) {
+                marks.set(m);
+                m_next_front.push_back(static_cast<offset_type>(o));
+            }
+            return true;
+        };
+        for (offset_type off : m_front) {
+            base = marks_index(marks, off);
+            std::size_t shell = m_stencil->shells.size();
+            for_each_shell_dir(off, [&](std::size_t i, std::size_t o) -> bool {
+                if (marks.test(base + marks.delta(m_stencil->shell_dirs[i])) && crysted(o))
+                    shell = i;
+                return shell == m_stencil->shells.size();
+            });
+            if (shell < m_stencil->shells.size())
+                for_each_nb(off, m_stencil->shells[shell], claim);
             else
-                ++i;
+                for_each_nb(off, *m_stencil, claim);
         }
 
-        std::unordered_set<std::size_t> new_front;
-        while (!m_front.empty()) {
-            auto poses = apply_shifts(upos(front_pop()));
-            for (auto& p : poses) {
-                std::size_t o = offset(p);
-                if (!crysted(o))
-                    new_front.insert(o);
+        for (offset_type o : m_front)
+            marks.unset_word(marks_index(marks, o));
+        for (offset_type o : m_next_front)
+            marks.unset_word(marks_index(marks, o));
+        std::sort(m_next_front.begin(), m_next_front.end());
+        m_front.swap(m_next_front);
+        update_front_bbox();
+    }
+
+    // same front as advance_front() for a dilatable() grain. the front is set in a bitset
+    // over its bbox widened by the range and dilated by the ball of the range word by word,
+    // claimed cells are then taken 64 at a time as dilated & ~crysted.
+    // crysted holds the cells in row-major order
+    template <typename NumGrainsFn>
+    void advance_front_bits(const grid_bitset& crysted, NumGrainsFn numgrs) {
+        remove_shared_front(numgrs);
+        if (m_front.empty()) {
+            update_front_bbox();
+            return;
+        }
+
+        auto& dimlens = m_layout.dim_lens();
+        pos_t<Dim> lo = static_cast<pos_t<Dim>>(upos(m_front.front()));
+        pos_t<Dim> hi = lo;
+        for (offset_type off : m_front) {
+            auto pos = upos(off);
+            for (std::size_t i = 0; i < Dim; ++i) {
+                lo[i] = std::min<std::int64_t>(lo[i], pos[i]);
+                hi[i] = std::max<std::int64_t>(hi[i], pos[i]);
             }
         }
-        m_front.assign(new_front.begin(), new_front.end());
+        std::int64_t srange = m_range;
+        upos_t<Dim> lens;
+        for (std::size_t i = 0; i < Dim; ++i) {
+            lo[i] = std::max<std::int64_t>(lo[i] - srange, 0);
+            hi[i] = std::min<std::int64_t>(hi[i] + srange, dimlens[i] - 1);
+            lens[i] = hi[i] - lo[i] + 1;
+        }
+
+        auto& bits = thread_box_bits();
+        bits.reset(lo, lens);
+        for (offset_type off : m_front)
+            bits.set(static_cast<upos_t<Dim>>(static_cast<pos_t<Dim>>(upos(off)) - lo));
+        if (m_kind == nbh::nbhood_kind::moore)
+            bits.dilate_box(m_range);
+        else
+            bits.dilate_diamond(m_range);
+
+        m_next_front.clear();
+        for (std::size_t r = 0; r < bits.num_rows(); ++r) {
+            auto pos = bits.row_pos(r);
+            std::size_t first = cgr::offset(pos, dimlens);
+            const std::uint64_t* row = bits.row(r);
+            for (std::size_t w = 0; w < bits.row_words(); ++w) {
+                std::uint64_t claimed = row[w] & ~crysted.word_at(first + w * 64);
+                while (claimed) {
+                    auto nbpos = pos;
+                    nbpos[0] += w * 64 + lowest_bit(claimed);
+                    m_next_front.push_back(static_cast<offset_type>(offset(nbpos)));
+                    claimed &= claimed - 1;
+                }
+            }
+        }
+        // rows and the cells in them go in increasing row-major order
+        if constexpr (!Layout::is_linear)
+            std::sort(m_next_front.begin(), m_next_front.end());
+        m_front.swap(m_next_front);
+        update_front_bbox();
     }
 
-    template <typename InnerFn>
-    void extract_front_from(std::vector<std::size_t> offs, InnerFn innfn, std::size_t thickness = 1) {
-        m_front = std::move(offs);
+    // the front as it is, e.g. restored from a checkpoint
+    template <typename OffsetIt>
+    void assign_front(OffsetIt first, OffsetIt last) {
+        m_front.assign(first, last);
+        update_front_bbox();
+    }
+    void clear_front() {
+        m_front.clear();
+        update_front_bbox();
+    }
+
+    template <typename OffsetIt, typename InnerFn>
+    void extract_front_from(OffsetIt first, OffsetIt last, InnerFn innfn, std::size_t thickness = 1) {
+        m_front.assign(first, last);
         thin_front(innfn, thickness);
+        update_front_bbox();
     }
 
     template <typename InnerFn>
     void thin_front(InnerFn innfn, std::size_t thickness = 1) {
-        auto prev_front = std::move(m_front);
-        auto shs = nbh::make_shifts<Dim>(norm_euclid<Dim>, thickness, thickness);
-        for (std::size_t off : prev_front) {
-            auto pos = static_cast<pos_t<Dim>>(upos(off));
-            pos_t<Dim> del = pos_t<Dim>::filled_with(thickness);
-            pos_t<Dim> corner0 = pos - del;
-            pos_t<Dim> corner1 = pos + del;
-            auto poses = inside(corner0) && inside(corner1) ?
-                nbh::apply_shifts(pos, shs) :
-                nbh::apply_shifts(pos, shs, [this](const pos_t<Dim>& p) -> bool { return inside(p); });
+        if (!m_thin_stencil || m_thin_stencil->bbox_range != thickness)
+            m_thin_stencil = m_stencils->get({ nbh::nbhood_kind::euclid, {}, thickness, thickness }, euclid_norm<Dim>());
+
+        m_next_front.clear();
+        for (offset_type off : m_front) {
             bool near_boundary = false;
-            for (auto& p : poses) {
-                if (!innfn(offset(p), grain())) {
-                    near_boundary = true;
-                    break;
-                }
-            }
+            for_each_nb(off, *m_thin_stencil, [&](std::size_t o, const auto&) -> bool {
+                near_boundary = !innfn(o, grain());
+                return !near_boundary;
+            });
             if (near_boundary)
-                m_front.push_back(off);
+                m_next_front.push_back(off);
         }
+        m_front.swap(m_next_front);
     }
 
-    clr_grain(const grain_type* grain, nbh::nbhood_kind kind, const upos_t<Dim>& dimlens, std::size_t nucleus_off)
-        : m_grain{ grain }, m_dim_lens{ dimlens }, m_front{ nucleus_off } {
+    // grains sharing stencils share the cache, a private one is made when it is null
+    clr_grain(const grain_type* grain, nbh::nbhood_kind kind, const Layout& layout, std::size_t nucleus_off,
+              std::shared_ptr<stencil_cache_type> stencils = nullptr)
+        : m_grain{ grain }, m_kind{ kind },
+          m_norm{ make_norm<Norm, Dim, Real>(kind, orientate_grow_dirs(grain, kind)) },
+          m_layout{ layout }, m_front{ static_cast<offset_type>(nucleus_off) }, m_stencils{ std::move(stencils) } {
+        if (!m_stencils)
+            m_stencils = std::make_shared<stencil_cache_type>(m_layout.dim_lens());
         m_center = upos(nucleus_off);
-        switch (kind) {
-        case nbh::nbhood_kind::von_neumann:
-            m_normfn = norm_taxicab<Dim>; break;
-
-        case nbh::nbhood_kind::moore:
-            m_normfn = norm_chebyshev<Dim>; break;
-
-        case nbh::nbhood_kind::euclid:
-            m_normfn = norm_euclid<Dim>; break;
-
-        case nbh::nbhood_kind::crystallographic:
-            m_normfn = make_norm_cryst_fn<Dim, Real>(orientate_grow_dirs()); break;
-
-        default:
-            std::terminate();
+        update_front_bbox();
+        if (kind == nbh::nbhood_kind::crystallographic) {
+            auto growdirs = orientate_grow_dirs(grain, kind);
+            for (auto& gd : growdirs)
+                m_norm_dirs.insert(m_norm_dirs.end(), gd.x.begin(), gd.x.end());
+            m_min_norm_ratio = norm_cryst_chebyshev_ratio<Dim, Real>(growdirs);
         }
     }
 
@@ -120,29 +278,85 @@ public:
 private:
     const grain_type* m_grain;
     upos_t<Dim> m_center;
-    norm_fn<Dim> m_normfn;
-    std::vector<pos_t<Dim>> m_shifts;
+    nbh::nbhood_kind m_kind;
+    Norm m_norm;
+    // key of the norm among the stencils
+    std::vector<Real> m_norm_dirs;
+    Real m_min_norm_ratio = 1;
     std::size_t m_range = 0;
-    std::size_t m_bbox_range = 0;
-    upos_t<Dim> m_dim_lens;
-    std::vector<std::size_t> m_front;
+    Layout m_layout;
+    std::vector<offset_type> m_front;
+    upos_t<Dim> m_front_min_corner;
+    upos_t<Dim> m_front_max_corner;
+    std::shared_ptr<stencil_cache_type> m_stencils;
+    std::shared_ptr<const stencil_type> m_stencil;
+    std::shared_ptr<const stencil_type> m_thin_stencil;
+    // buffer of the front being built, swapped with m_front
+    std::vector<offset_type> m_next_front;
 
     upos_t<Dim> upos(std::size_t off) const {
-        return cgr::upos(off, m_dim_lens);
+        return m_layout.upos(off);
     }
     std::size_t offset(const pos_t<Dim>& pos) const {
-        return cgr::offset(pos, m_dim_lens);
+        return m_layout.offset(static_cast<upos_t<Dim>>(pos));
     }
 
     bool inside(const pos_t<Dim>& pos) const {
         for (auto& e : pos.x)
             if (e < 0)
                 return false;
-        return cgr::inside(static_cast<upos_t<Dim>>(pos), m_dim_lens);
+        return cgr::inside(static_cast<upos_t<Dim>>(pos), m_layout.dim_lens());
+    }
+
+    // marks of the thread over the front bbox widened by the bbox range of the stencil,
+    // which holds every cell the front may claim. a thread needs no more than the bbox
+    // of the largest front it advances rather than the whole grid
+    box_marks<Dim>& front_marks(std::size_t bbox_range) const {
+        static thread_local box_marks<Dim> marks;
+        auto& dimlens = m_layout.dim_lens();
+        pos_t<Dim> lo;
+        upos_t<Dim> lens;
+        for (std::size_t i = 0; i < Dim; ++i) {
+            lo[i] = m_front_min_corner[i] - std::min(m_front_min_corner[i], bbox_range);
+            lens[i] = std::min(m_front_max_corner[i] + bbox_range, dimlens[i] - 1) - lo[i] + 1;
+        }
+        marks.reshape(lo, lens);
+        return marks;
+    }
+    std::size_t marks_index(const box_marks<Dim>& marks, std::size_t off) const {
+        return marks.index(static_cast<upos_t<Dim>>(static_cast<pos_t<Dim>>(upos(off)) - marks.min_corner()));
+    }
+    static box_bitset<Dim>& thread_box_bits() {
+        static thread_local box_bitset<Dim> bits;
+        return bits;
+    }
+
+    // an empty front has the bbox of the center
+    void update_front_bbox() {
+        m_front_min_corner = m_front.empty() ? m_center : upos(m_front.front());
+        m_front_max_corner = m_front_min_corner;
+        for (offset_type off : m_front) {
+            auto pos = upos(off);
+            for (std::size_t i = 0; i < Dim; ++i) {
+                m_front_min_corner[i] = std::min(m_front_min_corner[i], pos[i]);
+                m_front_max_corner[i] = std::max(m_front_max_corner[i], pos[i]);
+            }
+        }
+    }
+
+    // cells shared with the other grains stop growing
+    template <typename NumGrainsFn>
+    void remove_shared_front(NumGrainsFn numgrs) {
+        for (std::size_t i = 0; i < m_front.size();) {
+            if (numgrs(m_front[i]) > 1)
+                front_swap_remove(i);
+            else
+                ++i;
+        }
     }
 
     void front_push(std::size_t off) {
-        m_front.push_back(off);
+        m_front.push_back(static_cast<offset_type>(off));
     }
     std::size_t front_pop() {
         std::size_t tmp = m_front.back();
@@ -150,19 +364,55 @@ private:
         return tmp;
     }
 
-    std::vector<pos_t<Dim>> apply_shifts(const pos_t<Dim>& pos) const {
-        pos_t<Dim> del = pos_t<Dim>::filled_with(m_bbox_range);
-        pos_t<Dim> corner0 = pos - del;
-        pos_t<Dim> corner1 = pos + del;
-        if (inside(corner0) && inside(corner1))
-            return nbh::apply_shifts(pos, m_shifts);
-        else
-            return nbh::apply_shifts(pos, m_shifts, [this](const pos_t<Dim>& pos) -> bool { return inside(pos); });
+    // calls fn(nboff, shift) for the neighbours by st until it returns false. a cell at least
+    // bbox_range away from the faces takes the deltas unchecked in the linear layout
+    template <typename Fn>
+    void for_each_nb(std::size_t off, const stencil_type& st, Fn fn) const {
+        auto pos = static_cast<pos_t<Dim>>(upos(off));
+        if constexpr (Layout::is_linear) {
+            pos_t<Dim> del = pos_t<Dim>::filled_with(st.bbox_range);
+            if (inside(pos - del) && inside(pos + del)) {
+                for (std::size_t i = 0; i < st.deltas.size(); ++i)
+                    if (!fn(off + st.deltas[i], st.shifts[i]))
+                        return;
+                return;
+            }
+        }
+        for (auto& sh : st.shifts) {
+            auto nbpos = pos + static_cast<pos_t<Dim>>(sh);
+            if (inside(nbpos) && !fn(offset(nbpos), sh))
+                return;
+        }
+    }
+
+    // calls fn(i, nboff) for the neighbours along the shell directions of the stencil
+    // until it returns false
+    template <typename Fn>
+    void for_each_shell_dir(std::size_t off, Fn fn) const {
+        auto& st = *m_stencil;
+        auto pos = static_cast<pos_t<Dim>>(upos(off));
+        if constexpr (Layout::is_linear) {
+            pos_t<Dim> del = pos_t<Dim>::filled_with(1);
+            if (inside(pos - del) && inside(pos + del)) {
+                for (std::size_t i = 0; i < st.shell_dir_deltas.size(); ++i)
+                    if (!fn(i, off + st.shell_dir_deltas[i]))
+                        return;
+                return;
+            }
+        }
+        for (std::size_t i = 0; i < st.shell_dirs.size(); ++i) {
+            auto nbpos = pos + static_cast<pos_t<Dim>>(st.shell_dirs[i]);
+            if (inside(nbpos) && !fn(i, offset(nbpos)))
+                return;
+        }
     }
 
-    std::vector<grow_dir_t<Dim, Real>> orientate_grow_dirs() const {
-        auto transposed_orien = m_grain->orientation().transposed();
-        auto growdirs = m_grain->material()->grow_dirs();
+    // grow directions of the material in the grain's frame, only the crystallographic norm needs them
+    static std::vector<grow_dir_t<Dim, Real>> orientate_grow_dirs(const grain_type* grain, nbh::nbhood_kind kind) {
+        if (kind != nbh::nbhood_kind::crystallographic)
+            return {};
+        auto transposed_orien = grain->orientation().transposed();
+        auto growdirs = grain->material()->grow_dirs();
         for (auto& gd : growdirs)
             gd = spt::dot(transposed_orien, gd);
         return growdirs;
@@ -4,10 +4,13 @@
 #include <iostream>
 #include <fstream>
 #include <random>
+#include <string>
+#include <numeric>
 #include "sptalgs.h"
 #include "automata.h"
 #include "geometry.h"
 #include "progress-bar.h"
+#include "ensemble.h"
 
 #define DIM3
 
@@ -16,8 +19,8 @@ constexpr std::size_t dim = 3;
 #else
 constexpr std::size_t dim = 2;
 #endif
-std::size_t seed = 0;
-using automata_t = cgr::automata<dim>;
+// the grains grow by the crystallographic norm only, so it is not chosen at runtime
+using automata_t = cgr::automata<dim, double, std::uint32_t, cgr::linear_layout<dim>, cgr::cryst_norm<dim>>;
 using cell_t = cgr::cell<dim>;
 using grain_t = cgr::grain<dim>;
 using material_t = cgr::material<dim>;
@@ -39,7 +42,7 @@ std::uint64_t min_distance2(const cgr::upos_t<dim>& pos, const std::vector<cgr::
     return res;
 }
 
-std::vector<cgr::upos_t<dim>> make_random_poses(std::size_t size, std::size_t num, std::uint64_t min_dist2 = 0) {
+std::vector<cgr::upos_t<dim>> make_random_poses(std::uint64_t seed, std::size_t size, std::size_t num, std::uint64_t min_dist2 = 0) {
     std::vector<cgr::upos_t<dim>> res;
     std::mt19937_64 gen(seed);
     std::uniform_int_distribution<std::size_t> dis(0, size - 1);
@@ -79,7 +82,7 @@ int main_test() {
 
 void write_image_pixels(std::ostream& os, const automata_t& atmt, bool blackwhite = false) {
     for (std::size_t i = 0; i < atmt.dim_lens()[0] * atmt.dim_lens()[1]; ++i) {
-        auto curpos = atmt.upos(i);
+        auto curpos = cgr::upos(i, atmt.dim_lens());
         #ifdef DIM3
         //curpos[2] = static_cast<std::int64_t>(size) / 2;
         //curpos[2] = size - 1;
@@ -128,14 +131,53 @@ void show_picture(const automata_t& atmt) {
     std::system("python ./visualize.py");
 }
 
-int inner_main() {
-    std::size_t size = 300;
+struct sample_metrics {
+    double planarity = 0;
+    // per side_len, before the optimization
+    double best_nonplanarity = 0;
+    double worst_nonplanarity = 0;
+    double gmsh_nonplanarity = 0;
+    // after it
+    double optimized_gmsh_nonplanarity = 0;
+    std::vector<double> diams_inter4;
+};
+
+constexpr std::size_t sample_size = 300;
+
+// bytes a sample of sample_size peaks at: labels and their smoothing copy,
+// two voronoi site buffers, the geometry takes about as much again
+std::size_t sample_bytes() {
+    std::size_t num_cells = 1;
+    for (std::size_t i = 0; i < dim; ++i)
+        num_cells *= sample_size;
+    return 2 * num_cells * (2 * sizeof(automata_t::label_type) + 2 * sizeof(std::uint32_t));
+}
+
+// the automata after voronoi is saved to post-voronoi-<seed>.ckpt on save,
+// on resume it is loaded from there when the file exists and saved otherwise
+enum class ckpt_mode {
+    none,
+    save,
+    resume
+};
+
+// throws when the grains meet in a cell of more than 4 of them, which the geometry cannot take
+sample_metrics run_sample(std::uint64_t seed, ckpt_mode ckpt) {
+    std::size_t size = sample_size;
     std::size_t range = 5;
+    sample_metrics res;
+    // grains and materials of a resumed automata
+    cgr::grain_pool<dim> pool;
     automata_t atmt(size);
-    atmt.set_range(range);
+    // the geometry would fail on an overflowed cell after all the work below
+    auto overflow_hook = [](const automata_t&) {
+        throw std::runtime_error("cell grains num > 4");
+    };
 
-    //auto init_poses = make_central_pos(size);
-    auto init_poses = make_random_poses(size, 30, std::pow(range * 15, 2));
+    std::string ckpt_name = "post-voronoi-" + std::to_string(seed) + ".ckpt";
+    std::ifstream ickpt;
+    if (ckpt == ckpt_mode::resume)
+        ickpt.open(ckpt_name, std::ios::binary);
 
     //material_t mater;
     material_t mater({ 
@@ -147,93 +189,113 @@ int inner_main() {
         spt::vecd<dim>({ 4.0, 1.0 }).normalize(), 
         spt::vecd<dim>({ -1.0, 4.0 }).normalize() });
         #endif
-    //std::vector<grain_t> grains(init_poses.size(), grain_t(&mater));
     std::vector<grain_t> grains;
-    grains.reserve(init_poses.size());
-    std::mt19937_64 gen(seed);
-    std::uniform_real_distribution<double> dis(-1.0, std::nextafter(1.0, 2.0));
-    for (std::size_t i = 0; i < init_poses.size(); ++i) {
-        #ifdef DIM3
-        const double pi = 3.14159265359;
-        auto rot = spt::rotation(spt::vecd<dim>({ dis(gen), dis(gen), dis(gen) }).normalize(), std::abs(dis(gen)) * pi);
-        grains.emplace_back(&mater, rot);
-        #else
-        auto first = spt::vecd<dim>({ dis(gen), dis(gen) }).normalize();
-        spt::vecd<dim> second({ -first[1], first[0] });
-        grains.emplace_back(&mater, spt::matd<dim>{ first, second });
-        #endif
-    }
+    if (ickpt.is_open()) {
+        // a loaded automata comes without the hook
+        atmt = automata_t::load(ickpt, pool);
+        atmt.set_overflow_hook(overflow_hook);
+    } else {
+        atmt.set_range(range);
+        atmt.set_overflow_hook(overflow_hook);
+
+        //auto init_poses = make_central_pos(size);
+        auto init_poses = make_random_poses(seed, size, 30, std::pow(range * 15, 2));
+        grains.reserve(init_poses.size());
+        std::mt19937_64 gen(seed);
+        std::uniform_real_distribution<double> dis(-1.0, std::nextafter(1.0, 2.0));
+        for (std::size_t i = 0; i < init_poses.size(); ++i) {
+            #ifdef DIM3
+            const double pi = 3.14159265359;
+            auto rot = spt::rotation(spt::vecd<dim>({ dis(gen), dis(gen), dis(gen) }).normalize(), std::abs(dis(gen)) * pi);
+            grains.emplace_back(&mater, rot);
+            #else
+            auto first = spt::vecd<dim>({ dis(gen), dis(gen) }).normalize();
+            spt::vecd<dim> second({ -first[1], first[0] });
+            grains.emplace_back(&mater, spt::matd<dim>{ first, second });
+            #endif
+        }
+
+        for (std::size_t i = 0; i < init_poses.size(); ++i)
+            atmt.spawn_grain(&grains[i], atmt.offset(init_poses[i]), cgr::nbh::nbhood_kind::crystallographic);
 
-    for (std::size_t i = 0; i < init_poses.size(); ++i)
-        atmt.spawn_grain(&grains[i], atmt.offset(init_poses[i]), cgr::nbh::nbhood_kind::crystallographic);
-
-    
-    #define SHOWPIC
-    //progress_bar bar("crystallization", atmt.num_cells(), 70);
-    //while (!atmt.stop_condition()) {
-    //    //for (std::size_t i = 0; i < 5; ++i) {
-    //    while (!atmt.stop_condition()) {
-    //        atmt.iterate();
-    //        bar.set_count(atmt.num_crysted_cells());
-    //    }
-    //    
-    //    #ifdef SHOWPIC
-    //    show_picture(atmt);
-    //    #endif // SHOWPIC
-    //}
-    
-    //atmt.thin_boundary(4, 1);
-    //#ifdef SHOWPIC
-    //show_picture(atmt);
-    //#endif // SHOWPIC
-
-    atmt.voronoi<cgr::nbh::nbhood_kind::euclid>();
-    std::cout << "started smoothing" << std::endl;
+        atmt.voronoi_edt();
+        if (ckpt != ckpt_mode::none) {
+            std::ofstream ockpt(ckpt_name, std::ios::binary);
+            atmt.save(ockpt);
+        }
+    }
     atmt.smooth(1);
-    #ifdef SHOWPIC
-    show_picture(atmt);
-    #endif // SHOWPIC
 
     #ifdef DIM3
-    std::cout << "diams inter4: " << std::endl;
     for (auto d : atmt.diams_inter4())
-        std::cout << d << std::endl;
-    #endif // DIM3
+        res.diams_inter4.push_back(d);
 
-    #ifdef DIM3
     cgr::geo_from_automata simplegeo(&atmt);
     simplegeo.make();
 
-    std::cout << "planarity: " << simplegeo.planarity() << std::endl;
-    std::cout << "before nonplanarity optimization:" << std::endl;
-    std::cout << "  best nonplanarity/side_len: " << simplegeo.best_nonplanarity() / size << std::endl;
-    std::cout << "  worst nonplanarity/side_len: " << simplegeo.worst_nonplanarity() / size << std::endl;
-    std::cout << "  gmsh nonplanarity/side_len: " << simplegeo.gmsh_nonplanarity() / size << std::endl;
+    res.planarity = simplegeo.planarity();
+    res.best_nonplanarity = simplegeo.best_nonplanarity() / size;
+    res.worst_nonplanarity = simplegeo.worst_nonplanarity() / size;
+    res.gmsh_nonplanarity = simplegeo.gmsh_nonplanarity() / size;
     simplegeo.optimize_nonplanarity();
-    std::cout << "after nonplanarity optimization:" << std::endl;
-    std::cout << "  gmsh nonplanarity/side_len: " << simplegeo.gmsh_nonplanarity() / size << std::endl;
+    res.optimized_gmsh_nonplanarity = simplegeo.gmsh_nonplanarity() / size;
 
-    std::ofstream file("polycr.geo");
+    std::ofstream file("polycr-" + std::to_string(seed) + ".geo");
     simplegeo.write_geo(file);
-    //simplegeo.write_geo(std::cout);
     #endif // DIM3
 
-    return 0;
+    return res;
 }
 
-int main() {
-    seed = 0;
-    for (std::size_t i = 0;; ++i) {
-        std::cout << "iteration: " << i << std::endl;
-        std::cout << "seed: " << seed << std::endl;
-        try {
-            inner_main();
-        } catch (int _) {
-            ++seed;
-            continue;
+// --checkpoint saves every sample after voronoi, --resume starts the samples saved so
+int main(int argc, char* argv[]) {
+    ckpt_mode ckpt = ckpt_mode::none;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--checkpoint") {
+            ckpt = ckpt_mode::save;
+        } else if (arg == "--resume") {
+            ckpt = ckpt_mode::resume;
+        } else {
+            std::cerr << "unknown argument: " << arg << std::endl;
+            return 1;
         }
-        break;
     }
 
+    std::size_t num_samples = 100;
+    std::vector<std::uint64_t> seeds(num_samples);
+    std::iota(seeds.begin(), seeds.end(), 0);
+
+    auto plan = cgr::make_ensemble_plan(num_samples, sample_bytes());
+    std::cout << "samples: " << num_samples
+              << ", concurrent: " << plan.num_concurrent
+              << ", threads per sample: " << plan.threads_per_sample << std::endl;
+
+    progress_bar bar("ensemble", num_samples, 70);
+    std::size_t num_done = 0;
+    auto run = [ckpt](std::uint64_t seed) {
+        return run_sample(seed, ckpt);
+    };
+    auto samples = cgr::run_ensemble<sample_metrics>(seeds, plan, run,
+        [&](const cgr::ensemble_sample<sample_metrics>&) {
+            bar.set_count(++num_done);
+        });
+
+    std::size_t num_ok = 0;
+    std::cout << "seed ok seconds planarity gmsh_nonplanarity optimized_gmsh_nonplanarity max_diam_inter4" << std::endl;
+    for (auto& smp : samples) {
+        auto& m = smp.metrics;
+        double max_diam = m.diams_inter4.empty() ? 0 : *std::max_element(m.diams_inter4.begin(), m.diams_inter4.end());
+        std::cout << smp.seed << ' ' << smp.ok << ' ' << smp.seconds;
+        if (smp.ok)
+            std::cout << ' ' << m.planarity << ' ' << m.gmsh_nonplanarity
+                      << ' ' << m.optimized_gmsh_nonplanarity << ' ' << max_diam;
+        else
+            std::cout << " failed: " << smp.error;
+        std::cout << std::endl;
+        num_ok += smp.ok;
+    }
+    std::cout << "succeeded: " << num_ok << " of " << num_samples << std::endl;
+
     return 0;
 }
@@ -0,0 +1,330 @@
+// Copyright © 2020 Artyom Tokarev. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include "cgralgs.h"
+#include "transport.h"
+
+
+namespace cgr {
+
+// the grid cut into slabs along the last axis, one per rank of Transport. a rank keeps
+// an Automata over its slab widened by a halo of the neighbouring slabs, the halo covers
+// the stencil bbox of the range. a step advances the fronts within the slab, hands the cells
+// they claim in the halo to their owners, commits the claims of the slab, so a cell claimed
+// from both sides of a border takes the union of its claimants like in one automata,
+// and sends the changed cells near the borders to the halos of the neighbours.
+// a step fails on every rank or on none, so no rank is left waiting on a failed one
+template <typename Automata, typename Transport>
+class domain_automata {
+public:
+    static constexpr std::size_t dim = Automata::dim;
+    using automata_type = Automata;
+    using transport_type = Transport;
+    using storage_type = typename Automata::storage_type;
+    using cell_type = typename Automata::cell_type;
+    using grain_type = typename Automata::grain_type;
+    using grain_set_type = typename Automata::grain_set_type;
+    using grain_index_type = typename Automata::grain_index_type;
+    using offset_type = typename Automata::offset_type;
+    using overflow_hook_type = std::function<void(const domain_automata&)>;
+
+    const automata_type& local() const {
+        return m_local;
+    }
+    const transport_type& transport() const {
+        return m_transport;
+    }
+    const upos_t<dim>& dim_lens() const {
+        return m_dim_lens;
+    }
+    std::size_t range() const {
+        return m_local.range();
+    }
+    std::size_t halo() const {
+        return m_halo;
+    }
+    void set_engine(front_engine engine) {
+        m_local.set_engine(engine);
+    }
+    // every rank sets one, they are called on every rank after a step leaving
+    // overflowed cells in any slab, so a throwing hook stops every rank
+    void set_overflow_hook(overflow_hook_type hook) {
+        m_overflow_hook = std::move(hook);
+    }
+    // layers [owned_begin(), owned_end()) along the last axis are of the rank,
+    // the local automata starts at layer local_begin()
+    std::size_t owned_begin() const {
+        return m_owned_begin;
+    }
+    std::size_t owned_end() const {
+        return m_owned_end;
+    }
+    std::size_t local_begin() const {
+        return m_local_begin;
+    }
+    bool owns(const upos_t<dim>& pos) const {
+        return pos[dim - 1] >= m_owned_begin && pos[dim - 1] < m_owned_end;
+    }
+    bool in_halo(const upos_t<dim>& pos) const {
+        return !owns(pos) && pos[dim - 1] >= m_local_begin
+            && pos[dim - 1] < m_local_begin + m_local.dim_lens()[dim - 1];
+    }
+
+    upos_t<dim> local_pos(upos_t<dim> pos) const {
+        pos[dim - 1] -= m_local_begin;
+        return pos;
+    }
+    upos_t<dim> global_pos(std::size_t local_off) const {
+        auto res = m_local.upos(local_off);
+        res[dim - 1] += m_local_begin;
+        return res;
+    }
+    // of an owned cell or a cell in the halo
+    const cell_type* cell(const upos_t<dim>& pos) const {
+        return m_local.cell(local_pos(pos));
+    }
+
+    std::size_t num_owned_null_cells() const {
+        return m_local.num_null_cells() - m_num_halo_null_cells;
+    }
+    // overflowed cells of the slab, the faces of the slab inside the grid are not
+    // faces of the box and only halo cells lie on them
+    std::size_t num_owned_overflowed_cells() const {
+        return m_local.num_overflowed_cells() - m_num_halo_overflowed_cells;
+    }
+    // every rank calls the collective ones below in the same order
+    std::size_t num_null_cells() {
+        return m_transport.sum(num_owned_null_cells());
+    }
+    std::size_t num_overflowed_cells() {
+        return m_transport.sum(num_owned_overflowed_cells());
+    }
+    bool stop_condition() {
+        return num_null_cells() == 0;
+    }
+
+    // every rank spawns every grain in the same order, the one owning
+    // the nucleus grows it and the others keep its front empty until it comes
+    void spawn_grain(const grain_type* grain, const upos_t<dim>& nucleus_pos, nbh::nbhood_kind kind) {
+        if (owns(nucleus_pos))
+            m_local.spawn_grain(grain, local_pos(nucleus_pos), kind);
+        else
+            m_local.spawn_grain(grain, kind);
+        m_halo_synced = false;
+    }
+
+    // throws on every rank when a message was corrupted on any of them
+    bool iterate() {
+        if (stop_condition())
+            return false;
+        bool failed = false;
+        if (!m_halo_synced) {
+            failed |= !exchange_halo(true);
+            m_halo_synced = true;
+        }
+
+        m_local.advance_fronts();
+        failed |= !exchange_claims();
+        m_local.commit_fronts();
+        failed |= !exchange_halo(false);
+        m_local.thin_fronts();
+        if (m_transport.sum(failed) > 0)
+            throw std::runtime_error("cgr::domain_automata: corrupted message");
+        if (m_overflow_hook && num_overflowed_cells() > 0)
+            m_overflow_hook(*this);
+        return true;
+    }
+
+    // the slabs are as even as possible, each one must be at least as thick as the halo
+    domain_automata(const upos_t<dim>& dimlens, std::size_t range, Transport transport,
+                    storage_type storage = storage_type())
+        : m_transport{ std::move(transport) }, m_dim_lens{ dimlens }, m_halo{ std::max<std::size_t>(2 * range, 1) },
+          m_owned_begin{ slab_begin(m_transport.rank()) }, m_owned_end{ slab_begin(m_transport.rank() + 1) },
+          m_local_begin{ m_owned_begin - std::min(m_owned_begin, m_halo) },
+          m_local{ local_dim_lens(), std::move(storage) } {
+        if (m_transport.size() > 1 && m_dim_lens[dim - 1] / m_transport.size() < m_halo)
+            throw std::invalid_argument("cgr::domain_automata: slabs thinner than the halo");
+        m_local.set_range(range);
+        m_num_halo_null_cells = m_local.num_cells() / local_dim_lens()[dim - 1]
+            * (local_dim_lens()[dim - 1] - (m_owned_end - m_owned_begin));
+    }
+
+
+private:
+    Transport m_transport;
+    upos_t<dim> m_dim_lens;
+    std::size_t m_halo;
+    std::size_t m_owned_begin;
+    std::size_t m_owned_end;
+    std::size_t m_local_begin;
+    Automata m_local;
+    std::size_t m_num_halo_null_cells = 0;
+    std::size_t m_num_halo_overflowed_cells = 0;
+    bool m_halo_synced = false;
+    overflow_hook_type m_overflow_hook;
+
+    std::size_t slab_begin(std::size_t rank) const {
+        return m_dim_lens[dim - 1] * rank / m_transport.size();
+    }
+    upos_t<dim> local_dim_lens() const {
+        auto res = m_dim_lens;
+        res[dim - 1] = std::min(m_owned_end + m_halo, m_dim_lens[dim - 1]) - m_local_begin;
+        return res;
+    }
+
+    std::uint64_t global_index(std::size_t local_off) const {
+        return cgr::offset(static_cast<pos_t<dim>>(global_pos(local_off)), m_dim_lens);
+    }
+
+    // lower and upper neighbours, each with the layers of the slab in its halo
+    struct neighbour {
+        std::size_t rank;
+        std::size_t begin;
+        std::size_t end;
+    };
+    std::vector<neighbour> neighbours() const {
+        std::vector<neighbour> res;
+        if (m_transport.rank() > 0)
+            res.push_back({ m_transport.rank() - 1,
+                            m_owned_begin, std::min(m_owned_begin + m_halo, m_owned_end) });
+        if (m_transport.rank() + 1 < m_transport.size())
+            res.push_back({ m_transport.rank() + 1,
+                            std::max(m_owned_end - std::min(m_owned_end, m_halo), m_owned_begin), m_owned_end });
+        return res;
+    }
+
+    // front cells outside the slab are sent to their owners and removed,
+    // the ones received join the fronts of the same clr_grains.
+    // false when a message is corrupted, the rest of it is dropped
+    bool exchange_claims() {
+        auto& clrgrs = m_local.clr_grains();
+        for (auto& nb : neighbours()) {
+            bool lower = nb.rank < m_transport.rank();
+            auto outside = [this, lower](std::size_t off) -> bool {
+                auto layer = global_pos(off)[dim - 1];
+                return lower ? layer < m_owned_begin : layer >= m_owned_end;
+            };
+            byte_writer msg;
+            for (std::size_t i = 0; i < clrgrs.size(); ++i) {
+                auto& front = clrgrs[i].front();
+                auto num_outside = std::count_if(front.begin(), front.end(), outside);
+                if (num_outside == 0)
+                    continue;
+                msg.put(static_cast<std::uint64_t>(i));
+                msg.put(static_cast<std::uint64_t>(num_outside));
+                for (std::size_t off : front)
+                    if (outside(off))
+                        msg.put(global_index(off));
+                m_local.remove_front_cells(i, outside);
+            }
+            m_transport.send(nb.rank, msg.take());
+        }
+
+        bool res = true;
+        std::vector<offset_type> cells;
+        for (auto& nb : neighbours()) {
+            auto bytes = m_transport.recv(nb.rank);
+            byte_reader msg(bytes);
+            // the rest of the step is taken with the other ranks before failing
+            try {
+                while (!msg.done()) {
+                    auto i = msg.get<std::uint64_t>();
+                    auto num_cells = msg.get<std::uint64_t>();
+                    if (i >= clrgrs.size() || num_cells > bytes.size() / sizeof(std::uint64_t))
+                        throw std::runtime_error("cgr::domain_automata: bad claims");
+                    cells.resize(num_cells);
+                    for (auto& off : cells) {
+                        auto pos = cgr::upos(msg.get<std::uint64_t>(), m_dim_lens);
+                        if (!owns(pos))
+                            throw std::runtime_error("cgr::domain_automata: bad claims");
+                        off = static_cast<offset_type>(m_local.offset(local_pos(pos)));
+                    }
+                    std::sort(cells.begin(), cells.end());
+                    m_local.add_front_cells(i, cells.begin(), cells.end());
+                }
+            } catch (const std::runtime_error&) {
+                res = false;
+            }
+        }
+        return res;
+    }
+
+    // the grain sets of the cells of the slab in the halos of the neighbours, all of them
+    // or the ones in the fronts only, which are the ones changed by the last commit.
+    // false when a message is corrupted, the rest of it is dropped
+    bool exchange_halo(bool all) {
+        for (auto& nb : neighbours()) {
+            std::vector<std::size_t> offs;
+            if (all) {
+                for (std::size_t off = 0; off < m_local.num_offsets(); ++off)
+                    if (m_local.valid(off)) {
+                        auto layer = global_pos(off)[dim - 1];
+                        if (layer >= nb.begin && layer < nb.end)
+                            offs.push_back(off);
+                    }
+            } else {
+                for (auto& clrgr : m_local.clr_grains())
+                    for (std::size_t off : clrgr.front()) {
+                        auto layer = global_pos(off)[dim - 1];
+                        if (layer >= nb.begin && layer < nb.end)
+                            offs.push_back(off);
+                    }
+                std::sort(offs.begin(), offs.end());
+                offs.erase(std::unique(offs.begin(), offs.end()), offs.end());
+            }
+
+            byte_writer msg;
+            for (std::size_t off : offs) {
+                msg.put(global_index(off));
+                auto lbl = m_local.label(off);
+                if (lbl == Automata::null_label) {
+                    msg.put(static_cast<std::uint8_t>(0));
+                    continue;
+                }
+                auto& grs = m_local.grain_set(lbl);
+                msg.put(static_cast<std::uint8_t>(grs.size()));
+                for (grain_index_type gr : grs)
+                    msg.put(gr);
+            }
+            m_transport.send(nb.rank, msg.take());
+        }
+
+        bool res = true;
+        for (auto& nb : neighbours()) {
+            auto bytes = m_transport.recv(nb.rank);
+            byte_reader msg(bytes);
+            try {
+                while (!msg.done()) {
+                    auto pos = cgr::upos(msg.get<std::uint64_t>(), m_dim_lens);
+                    std::size_t size = msg.get<std::uint8_t>();
+                    if (!in_halo(pos) || size > Automata::max_cell_grains)
+                        throw std::runtime_error("cgr::domain_automata: bad halo cell");
+                    grain_set_type grs;
+                    for (std::size_t k = 0; k < size; ++k)
+                        grs.insert(msg.get<grain_index_type>());
+                    std::size_t off = m_local.offset(local_pos(pos));
+                    bool was_null = m_local.label(off) == Automata::null_label;
+                    std::size_t num_overflowed = m_local.num_overflowed_cells();
+                    m_local.assign_cell(off, grs);
+                    bool is_null = m_local.label(off) == Automata::null_label;
+                    m_num_halo_null_cells -= was_null && !is_null;
+                    m_num_halo_null_cells += !was_null && is_null;
+                    m_num_halo_overflowed_cells += m_local.num_overflowed_cells() - num_overflowed;
+                }
+            } catch (const std::runtime_error&) {
+                res = false;
+            }
+        }
+        return res;
+    }
+};
+
+} // namespace cgr
@@ -0,0 +1,135 @@
+// Copyright © 2020 Artyom Tokarev. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+
+namespace cgr {
+
+// physical memory the process may take without swapping, 0 when unknown
+inline std::size_t available_memory() {
+#if defined(_WIN32)
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (!GlobalMemoryStatusEx(&status))
+        return 0;
+    return static_cast<std::size_t>(status.ullAvailPhys);
+#else
+    // MemAvailable counts the reclaimable page cache, free pages do not
+    std::ifstream meminfo("/proc/meminfo");
+    std::string key;
+    std::size_t kbytes;
+    std::string unit;
+    while (meminfo >> key >> kbytes >> unit)
+        if (key == "MemAvailable:")
+            return kbytes * 1024;
+    long pages = ::sysconf(_SC_AVPHYS_PAGES);
+    long page = ::sysconf(_SC_PAGESIZE);
+    return pages > 0 && page > 0 ? static_cast<std::size_t>(pages) * page : 0;
+#endif
+}
+
+
+// samples run at once and the threads of each one
+struct ensemble_plan {
+    std::size_t num_concurrent = 1;
+    std::size_t threads_per_sample = 1;
+};
+
+// as many samples at once as fit into the memory, at most one per core,
+// the cores are shared evenly between them. mem_fraction of the available memory
+// is given to the samples, the rest is left to the system
+inline ensemble_plan make_ensemble_plan(std::size_t num_samples, std::size_t sample_bytes,
+                                        double mem_fraction = 0.8) {
+    std::size_t num_cores = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+    std::size_t mem = static_cast<std::size_t>(available_memory() * mem_fraction);
+    std::size_t num_fit = sample_bytes > 0 && mem > 0 ? mem / sample_bytes : num_cores;
+
+    ensemble_plan res;
+    res.num_concurrent = std::clamp<std::size_t>(std::min(num_fit, num_samples), 1, num_cores);
+    res.threads_per_sample = std::max<std::size_t>(num_cores / res.num_concurrent, 1);
+    return res;
+}
+
+
+// outcome of the sample of one seed
+template <typename Metrics>
+struct ensemble_sample {
+    std::uint64_t seed = 0;
+    bool ok = false;
+    // what the sample failed with
+    std::string error;
+    double seconds = 0;
+    Metrics metrics{};
+};
+
+// fn(seed) -> Metrics for every seed, plan.num_concurrent of them at once on threads
+// running OpenMP regions of plan.threads_per_sample threads. a sample failing with
+// an exception, an int included, is recorded and its thread takes the next seed.
+// done(sample) is called under a lock as soon as a sample ends, results are in seed order
+template <typename Metrics, typename Fn, typename DoneFn>
+std::vector<ensemble_sample<Metrics>> run_ensemble(const std::vector<std::uint64_t>& seeds,
+                                                   const ensemble_plan& plan, Fn fn, DoneFn done) {
+    std::vector<ensemble_sample<Metrics>> res(seeds.size());
+    std::atomic<std::size_t> next{ 0 };
+    std::mutex done_mutex;
+
+    auto work = [&] {
+#if defined(_OPENMP)
+        // the setting is of the calling thread only
+        omp_set_num_threads(static_cast<int>(plan.threads_per_sample));
+#endif
+        for (std::size_t k = next++; k < seeds.size(); k = next++) {
+            auto& smp = res[k];
+            smp.seed = seeds[k];
+            auto start = std::chrono::steady_clock::now();
+            try {
+                smp.metrics = fn(smp.seed);
+                smp.ok = true;
+            } catch (const std::exception& e) {
+                smp.error = e.what();
+            } catch (int code) {
+                smp.error = "code " + std::to_string(code);
+            } catch (...) {
+                smp.error = "unknown error";
+            }
+            smp.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            std::lock_guard<std::mutex> lock(done_mutex);
+            done(static_cast<const ensemble_sample<Metrics>&>(smp));
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < plan.num_concurrent; ++i)
+        threads.emplace_back(work);
+    work();
+    for (auto& th : threads)
+        th.join();
+    return res;
+}
+
+} // namespace cgr
@@ -13,6 +13,8 @@
 
 namespace cgr {
 
+// Automata is a 3d automata of grgeo::real_type, any layout or norm
+template <typename Automata = automata<3, grgeo::real_type>>
 class geo_from_automata {
 public:
     static constexpr std::size_t dim = 3;
@@ -34,7 +36,7 @@ public:
     template <typename T>
     using vector2gd = std::vector<std::vector<T>>;
 
-    using automata_type = cgr::automata<dim, real_type>;
+    using automata_type = Automata;
     using gr_geometry = grgeo::gr_geometry;
 
     void add_empty_gr_volumes(const std::vector<grains_container>& grconts) {
@@ -92,14 +94,20 @@ public:
     
     template <std::size_t Dir>
     std::size_t shift(std::size_t origin, std::size_t dist) const {
-        if constexpr (Dir == 0) 
-            return origin + dist;
-
-        if constexpr (Dir == 1) 
-            return origin + dim_lens()[0] * dist;
-
-        if constexpr (Dir == 2) 
-            return origin + dim_lens()[1] * dim_lens()[0] * dist;
+        if constexpr (automata_type::layout_type::is_linear) {
+            if constexpr (Dir == 0) 
+                return origin + dist;
+
+            if constexpr (Dir == 1) 
+                return origin + dim_lens()[0] * dist;
+
+            if constexpr (Dir == 2) 
+                return origin + dim_lens()[1] * dim_lens()[0] * dist;
+        } else {
+            auto pos = m_automata->upos(origin);
+            pos[Dir] += dist;
+            return m_automata->offset(pos);
+        }
     }
     // exclusive dist_end
     template <std::size_t Dir>
@@ -192,7 +200,9 @@ public:
     
     offsets_container boundaries_offsets() const {
         offsets_container res;
-        for (std::size_t i = 0; i < num_cells(); ++i) {
+        for (std::size_t i = 0; i < num_offsets(); ++i) {
+            if (!valid(i))
+                continue;
             if (grains(i).size() > 1)
                 res.push_back(i);
             // dirty hack
@@ -256,7 +266,7 @@ public:
     vec3r central_pos(const offsets_container& offsets) const {
         vecu acc;
         for (auto off : offsets)
-            acc += cgr::upos(off, dim_lens());
+            acc += m_automata->upos(off);
         auto accreal = static_cast<vec3r>(acc);
         for (auto& e : accreal.x)
             e /= offsets.size();
@@ -264,6 +274,10 @@ public:
     }
 
     void make() {
+        if (auto err = is_exception()) {
+            std::cout << "error: " << *err;
+            throw -1;
+        }
         m_boxbry_grconts.clear();
         add_boxbry_grains();
 
@@ -307,26 +321,38 @@ public:
         m_gr_geo.geometry.write(os);
     }
 
+    // the automata counts the overflowed cells by the faces of the box they lie on
     std::optional<std::string> is_inner_max_order_overflow() const {
-        for (std::size_t i = 0; i < num_cells(); ++i)
-            if (grains(i).size() > 4)
-                return "Max boundary order overflow\n";
+        if (m_automata->num_overflowed_cells(0) > 0)
+            return "Max boundary order overflow\n";
         return std::nullopt;
     }
     std::optional<std::string> is_box_vertices_max_order_overflow() const {
-        //
+        if (m_automata->num_overflowed_cells(3) > 0)
+            return "Max box vertex order overflow\n";
+        return std::nullopt;
     }
     std::optional<std::string> is_box_edges_max_order_overflow() const {
-        //
+        if (m_automata->num_overflowed_cells(2) > 0)
+            return "Max box edge order overflow\n";
+        return std::nullopt;
     }
     std::optional<std::string> is_box_faces_max_order_overflow() const {
-        //
+        if (m_automata->num_overflowed_cells(1) > 0)
+            return "Max box face order overflow\n";
+        return std::nullopt;
     }
     std::optional<std::string> is_exception() const {
-        //
+        if (auto res = is_inner_max_order_overflow())
+            return res;
+        if (auto res = is_box_vertices_max_order_overflow())
+            return res;
+        if (auto res = is_box_edges_max_order_overflow())
+            return res;
+        return is_box_faces_max_order_overflow();
     }
 
-    geo_from_automata(const automata_type* automata)
+    geo_from_automata(const Automata* automata)
         : m_automata(automata) {}
 
 
@@ -365,8 +391,11 @@ private:
                     m_gr_geo.geometry.get_line(line.tag).point_tags[1] = pnt.tag;
     }
 
-    std::size_t num_cells() const {
-        return m_automata->num_cells();
+    std::size_t num_offsets() const {
+        return m_automata->num_offsets();
+    }
+    bool valid(std::size_t offset) const {
+        return m_automata->valid(offset);
     }
     const cell_type* cell(std::size_t offset) const {
         return m_automata->cell(offset);
@@ -388,7 +417,7 @@ private:
     }
     const grains_container& grains(std::size_t offset) const {
         vecu dlens = dim_lens();
-        spt::vec3u upos = cgr::upos(offset, dlens);
+        spt::vec3u upos = m_automata->upos(offset);
 
         for (std::size_t i = 0; i < 3; ++i)
             if (upos[i] == 0 ||
@@ -0,0 +1,104 @@
+// Copyright © 2020 Artyom Tokarev. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <limits>
+#include <utility>
+#include <functional>
+#include <stdexcept>
+
+
+namespace cgr {
+
+// dense table of unique keys, each key gets the next index on first insertion.
+// lookup goes through a flat open-addressing (linear probing) array of indices
+template <typename Key, typename Index = std::uint32_t, typename Hash = std::hash<Key>>
+class intern_table {
+public:
+    using key_type = Key;
+    using index_type = Index;
+    static constexpr Index npos = std::numeric_limits<Index>::max();
+
+    std::size_t size() const {
+        return m_keys.size();
+    }
+    const std::vector<Key>& keys() const {
+        return m_keys;
+    }
+    const Key& operator[](Index idx) const {
+        return m_keys[idx];
+    }
+
+    Index find(const Key& key) const {
+        if (m_slots.empty())
+            return npos;
+        return m_slots[slot_of(key)];
+    }
+    std::pair<Index, bool> insert(const Key& key) {
+        if (m_slots.empty())
+            rehash(16);
+        std::size_t slot = slot_of(key);
+        if (m_slots[slot] != npos)
+            return { m_slots[slot], false };
+
+        if (2 * (m_keys.size() + 1) > m_slots.size()) {
+            rehash(2 * m_slots.size());
+            slot = slot_of(key);
+        }
+
+        if (m_keys.size() == npos)
+            throw std::overflow_error("cgr::intern_table: index type overflow");
+        Index idx = static_cast<Index>(m_keys.size());
+        m_keys.push_back(key);
+        m_slots[slot] = idx;
+        return { idx, true };
+    }
+
+    void reserve(std::size_t num_keys) {
+        m_keys.reserve(num_keys);
+        std::size_t num_slots = 16;
+        while (num_slots < 2 * num_keys)
+            num_slots *= 2;
+        if (num_slots > m_slots.size())
+            rehash(num_slots);
+    }
+    void clear() {
+        m_keys.clear();
+        m_slots.clear();
+    }
+
+
+private:
+    std::vector<Key> m_keys;
+    // power of two sized, npos marks an empty slot
+    std::vector<Index> m_slots;
+
+    std::size_t home_slot(const Key& key) const {
+        // fibonacci hashing spreads weak hashes over the high bits
+        std::uint64_t h = static_cast<std::uint64_t>(Hash{}(key)) * 0x9e3779b97f4a7c15ull;
+        return static_cast<std::size_t>(h >> 32) & (m_slots.size() - 1);
+    }
+    std::size_t slot_of(const Key& key) const {
+        std::size_t mask = m_slots.size() - 1;
+        std::size_t slot = home_slot(key);
+        while (m_slots[slot] != npos && !(m_keys[m_slots[slot]] == key))
+            slot = (slot + 1) & mask;
+        return slot;
+    }
+
+    void rehash(std::size_t num_slots) {
+        m_slots.assign(num_slots, npos);
+        std::size_t mask = num_slots - 1;
+        for (std::size_t i = 0; i < m_keys.size(); ++i) {
+            std::size_t slot = home_slot(m_keys[i]);
+            while (m_slots[slot] != npos)
+                slot = (slot + 1) & mask;
+            m_slots[slot] = static_cast<Index>(i);
+        }
+    }
+};
+
+} // namespace cgr
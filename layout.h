@@ -0,0 +1,146 @@
+// Copyright © 2020 Artyom Tokarev. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <numeric>
+#include <algorithm>
+#include <functional>
+#include "cgralgs.h"
+
+
+namespace cgr {
+
+// a layout maps the positions of a grid one to one onto offsets in [0, num_offsets()),
+// the offsets not mapped to (padding) are told apart by valid()
+
+// row-major order, x varies fastest
+template <std::size_t Dim>
+class linear_layout {
+public:
+    static constexpr bool is_linear = true;
+
+    const upos_t<Dim>& dim_lens() const {
+        return m_dim_lens;
+    }
+    std::size_t num_offsets() const {
+        return m_num_offsets;
+    }
+    // distance between offsets of the cells adjacent along axis k
+    std::size_t stride(std::size_t k) const {
+        std::size_t res = 1;
+        for (std::size_t i = 0; i < k; ++i)
+            res *= m_dim_lens[i];
+        return res;
+    }
+
+    constexpr bool valid(std::size_t) const {
+        return true;
+    }
+    std::size_t offset(const upos_t<Dim>& pos) const {
+        return cgr::offset(static_cast<pos_t<Dim>>(pos), m_dim_lens);
+    }
+    upos_t<Dim> upos(std::size_t off) const {
+        return cgr::upos(off, m_dim_lens);
+    }
+
+    linear_layout(const upos_t<Dim>& dimlens) : m_dim_lens{ dimlens } {
+        m_num_offsets = std::accumulate(
+            m_dim_lens.x.begin(), m_dim_lens.x.end(),
+            static_cast<std::size_t>(1), std::multiplies<std::size_t>());
+    }
+
+
+private:
+    upos_t<Dim> m_dim_lens;
+    std::size_t m_num_offsets;
+};
+
+
+// cubic bricks of 2^SideLog2 cells per side each stored contiguously in row-major order,
+// bricks follow each other in morton (z-)order of their positions, so cells close
+// in space are close in memory along every axis. bricks crossing the far faces
+// of the grid are padded. tables are shared between copies
+template <std::size_t Dim, std::size_t SideLog2 = 3>
+class brick_layout {
+public:
+    static constexpr bool is_linear = false;
+    static constexpr std::size_t brick_side = static_cast<std::size_t>(1) << SideLog2;
+    static constexpr std::size_t brick_volume = static_cast<std::size_t>(1) << (Dim * SideLog2);
+
+    const upos_t<Dim>& dim_lens() const {
+        return m_dim_lens;
+    }
+    std::size_t num_offsets() const {
+        return m_tables->brick_poses.size() * brick_volume;
+    }
+
+    bool valid(std::size_t off) const {
+        return cgr::inside(upos(off), m_dim_lens);
+    }
+    std::size_t offset(const upos_t<Dim>& pos) const {
+        std::size_t brick = 0;
+        std::size_t mul = 1;
+        std::size_t inner = 0;
+        for (std::size_t i = 0; i < Dim; ++i) {
+            brick += (pos[i] >> SideLog2) * mul;
+            mul *= m_num_bricks[i];
+            inner |= (pos[i] & (brick_side - 1)) << (i * SideLog2);
+        }
+        return (m_tables->ranks[brick] << (Dim * SideLog2)) | inner;
+    }
+    upos_t<Dim> upos(std::size_t off) const {
+        auto& brick_pos = m_tables->brick_poses[off >> (Dim * SideLog2)];
+        upos_t<Dim> res;
+        for (std::size_t i = 0; i < Dim; ++i)
+            res[i] = (brick_pos[i] << SideLog2) | ((off >> (i * SideLog2)) & (brick_side - 1));
+        return res;
+    }
+
+    brick_layout(const upos_t<Dim>& dimlens) : m_dim_lens{ dimlens } {
+        std::size_t num_bricks = 1;
+        for (std::size_t i = 0; i < Dim; ++i) {
+            m_num_bricks[i] = (m_dim_lens[i] + brick_side - 1) >> SideLog2;
+            num_bricks *= m_num_bricks[i];
+        }
+
+        std::vector<std::pair<std::uint64_t, std::size_t>> codes(num_bricks);
+        for (std::size_t b = 0; b < num_bricks; ++b)
+            codes[b] = { morton(cgr::upos(b, m_num_bricks)), b };
+        std::sort(codes.begin(), codes.end());
+
+        auto tables = std::make_shared<tables_type>();
+        tables->ranks.resize(num_bricks);
+        tables->brick_poses.resize(num_bricks);
+        for (std::size_t r = 0; r < num_bricks; ++r) {
+            tables->ranks[codes[r].second] = r;
+            tables->brick_poses[r] = cgr::upos(codes[r].second, m_num_bricks);
+        }
+        m_tables = std::move(tables);
+    }
+
+
+private:
+    struct tables_type {
+        // rank in morton order of each brick by its row-major index and back
+        std::vector<std::size_t> ranks;
+        std::vector<upos_t<Dim>> brick_poses;
+    };
+
+    upos_t<Dim> m_dim_lens;
+    upos_t<Dim> m_num_bricks;
+    std::shared_ptr<const tables_type> m_tables;
+
+    static std::uint64_t morton(const upos_t<Dim>& pos) {
+        std::uint64_t res = 0;
+        for (std::size_t bit = 0; bit * Dim < 64; ++bit)
+            for (std::size_t i = 0; i < Dim && bit * Dim + i < 64; ++i)
+                res |= ((pos[i] >> bit) & 1) << (bit * Dim + i);
+        return res;
+    }
+};
+
+} // namespace cgr
@@ -3,10 +3,14 @@
 
 #pragma once
 #include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
 #include <vector>
 #include <functional>
 #include "vec.h"
 #include "cgralgs.h"
+#include "norm-batch.h"
 
 
 namespace cgr::nbh {
@@ -19,8 +23,9 @@ enum class nbhood_kind {
 };
 
 
-template <std::size_t Dim>
-bool inside_nbhood(norm_fn<Dim> normfn, const pos_t<Dim>& pos, std::size_t range) {
+// NormFn is any callable on pos_t<Dim>, norm_fn<Dim> or one of the norms of norms.h
+template <std::size_t Dim, typename NormFn = norm_fn<Dim>>
+bool inside_nbhood(const NormFn& normfn, const pos_t<Dim>& pos, std::size_t range) {
     return normfn(pos) <= range;
 }
 
@@ -40,42 +45,43 @@ template <std::size_t Dim>
 using inside_fn = std::function<bool(const pos_t<Dim>&)>;
 
 
-template <std::size_t Dim>
-std::vector<pos_t<Dim>> make_shifts(norm_fn<Dim> normfn, std::size_t range, std::size_t bbox_range = 0) {
+// norms of the whole bbox are taken in one batch, see eval_norms().
+// the shifts are stored with Coord coordinates, the bbox must fit in them
+template <std::size_t Dim, typename NormFn = norm_fn<Dim>, typename Coord = std::int64_t>
+std::vector<pos_t<Dim, Coord>> make_shifts(const NormFn& normfn, std::size_t range, std::size_t bbox_range = 0) {
     if (bbox_range == 0)
         bbox_range = range;
+    if (bbox_range > static_cast<std::size_t>(std::numeric_limits<Coord>::max()))
+        throw std::overflow_error("cgr::nbh::make_shifts: bbox range does not fit in Coord");
 
-    std::vector<pos_t<Dim>> res;
     std::size_t buf = 2 * bbox_range + 1;
     std::int64_t sbbox_range = bbox_range;
-    if constexpr (Dim == 2) {
-        res.reserve(buf * buf - 1);
-        for (std::int64_t y = -sbbox_range; y <= sbbox_range; ++y) {
-            for (std::int64_t x = -sbbox_range; x <= sbbox_range; ++x) {
-                auto sh = pos_t<Dim>({ x, y });
-                if (!(x == 0 && y == 0) &&
-                    inside_nbhood<Dim>(normfn, sh, range))
-                    res.push_back(sh);
-            }
-        }
-        res.shrink_to_fit();
-
-    } else if constexpr (Dim == 3) {
-        res.reserve(buf * buf * buf - 1);
-        for (std::int64_t z = -sbbox_range; z <= sbbox_range; ++z) {
-            for (std::int64_t y = -sbbox_range; y <= sbbox_range; ++y) {
-                for (std::int64_t x = -sbbox_range; x <= sbbox_range; ++x) {
-                    auto sh = pos_t<Dim>({ x, y, z });
-                    if (!(x == 0 && y == 0 && z == 0) &&
-                        inside_nbhood<Dim>(normfn, sh, range))
-                        res.push_back(sh);
-                }
-            }
-        }
-        res.shrink_to_fit();
-
-    } else {
-        static_assert(false);
+    std::size_t num_poses = 1;
+    for (std::size_t i = 0; i < Dim; ++i)
+        num_poses *= buf;
+
+    // bbox positions but the center, x varies fastest
+    pos_batch<Dim> poses;
+    poses.reserve(num_poses - 1);
+    pos_t<Dim> sh = pos_t<Dim>::filled_with(-sbbox_range);
+    for (std::size_t n = 0; n < num_poses; ++n) {
+        if (sh != pos_t<Dim>::filled_with(0))
+            poses.push_back(sh);
+        for (std::size_t i = 0; i < Dim && ++sh[i] > sbbox_range; ++i)
+            sh[i] = -sbbox_range;
+    }
+
+    std::vector<std::size_t> norms(poses.size());
+    eval_norms<Dim>(normfn, poses, norms.data());
+
+    std::vector<pos_t<Dim, Coord>> res;
+    for (std::size_t n = 0; n < poses.size(); ++n) {
+        if (norms[n] > range)
+            continue;
+        pos_t<Dim, Coord> res_sh;
+        for (std::size_t i = 0; i < Dim; ++i)
+            res_sh[i] = static_cast<Coord>(poses.coords(i)[n]);
+        res.push_back(res_sh);
     }
 
     return res;
@@ -99,6 +105,17 @@ offsets_t poses_to_offsets(const std::vector<pos_t<Dim>>& poses, const spt::vecu
     return res;
 }
 
+// linear offset differences of shifts, valid for the cells
+// whose every shifted position stays inside the grid
+template <std::size_t Dim, typename Coord = std::int64_t, typename Delta = std::int64_t>
+std::vector<Delta> shifts_to_deltas(const std::vector<pos_t<Dim, Coord>>& shifts, const spt::vecu<Dim>& dimlens) {
+    std::vector<Delta> res;
+    res.reserve(shifts.size());
+    for (auto& shift : shifts)
+        res.push_back(static_cast<Delta>(cgr::offset(static_cast<pos_t<Dim>>(shift), dimlens)));
+    return res;
+}
+
 template <std::size_t Dim, typename InsideFn>
 std::vector<pos_t<Dim>> apply_shifts(
     const pos_t<Dim>& pos, const std::vector<pos_t<Dim>>& shifts,
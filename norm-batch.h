@@ -0,0 +1,123 @@
+// Copyright © 2020 Artyom Tokarev. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <array>
+#include <vector>
+#include <limits>
+#include <type_traits>
+#include "cgralgs.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+namespace cgr {
+
+// positions as a structure of arrays of coordinates
+template <std::size_t Dim, typename Real = double>
+class pos_batch {
+public:
+    std::size_t size() const {
+        return m_coords[0].size();
+    }
+    const Real* coords(std::size_t axis) const {
+        return m_coords[axis].data();
+    }
+
+    void push_back(const pos_t<Dim>& pos) {
+        for (std::size_t i = 0; i < Dim; ++i)
+            m_coords[i].push_back(static_cast<Real>(pos[i]));
+    }
+    void clear() {
+        for (auto& c : m_coords)
+            c.clear();
+    }
+    void reserve(std::size_t n) {
+        for (auto& c : m_coords)
+            c.reserve(n);
+    }
+
+
+private:
+    std::array<std::vector<Real>, Dim> m_coords;
+};
+
+
+// res[i] = norm_cryst of the i-th position, inv_dots[j] = 1 / (growdirs[j], growdirs[j]).
+// the sums go in the order of spt::dot, so every path gives the values of the scalar norm
+// as long as products and sums are not contracted into fused multiply-adds: /fp:precise
+// without /fp:contract, -ffp-contract=off with gcc when FMA is enabled (-mfma, -march).
+// with AVX2 (/arch:AVX2, -mavx2) doubles are taken 4 at once, otherwise the loop is scalar
+template <std::size_t Dim, typename Real>
+void norm_cryst_batch(const std::vector<grow_dir_t<Dim, Real>>& growdirs, const std::vector<Real>& inv_dots,
+                      const pos_batch<Dim, Real>& poses, std::size_t* res) {
+    std::size_t n = poses.size();
+    std::size_t i = 0;
+
+#if defined(__AVX2__)
+    if constexpr (std::is_same_v<Real, double>) {
+        const __m256d sign_mask = _mm256_set1_pd(-0.0);
+        std::array<const double*, Dim> cs;
+        for (std::size_t k = 0; k < Dim; ++k)
+            cs[k] = poses.coords(k);
+
+        alignas(32) double maxpns[4];
+        for (; i + 4 <= n; i += 4) {
+            // a built-in array, std::array<__m256d> drops the alignment attribute of the type
+            __m256d c[Dim];
+            for (std::size_t k = 0; k < Dim; ++k)
+                c[k] = _mm256_loadu_pd(cs[k] + i);
+
+            __m256d maxpn = _mm256_setzero_pd();
+            for (std::size_t j = 0; j < growdirs.size(); ++j) {
+                __m256d dot = _mm256_mul_pd(c[0], _mm256_set1_pd(growdirs[j][0]));
+                for (std::size_t k = 1; k < Dim; ++k)
+                    dot = _mm256_add_pd(dot, _mm256_mul_pd(c[k], _mm256_set1_pd(growdirs[j][k])));
+                __m256d pn = _mm256_mul_pd(_mm256_andnot_pd(sign_mask, dot), _mm256_set1_pd(inv_dots[j]));
+                maxpn = _mm256_max_pd(pn, maxpn);
+            }
+            maxpn = _mm256_add_pd(maxpn, _mm256_set1_pd(std::numeric_limits<double>::epsilon()));
+            _mm256_store_pd(maxpns, maxpn);
+            for (std::size_t l = 0; l < 4; ++l)
+                res[i + l] = static_cast<std::size_t>(maxpns[l]);
+        }
+    }
+#endif
+
+    for (; i < n; ++i) {
+        Real maxpn = 0;
+        for (std::size_t j = 0; j < growdirs.size(); ++j) {
+            Real dot = 0;
+            for (std::size_t k = 0; k < Dim; ++k)
+                dot += poses.coords(k)[i] * growdirs[j][k];
+            auto pn = std::abs(dot) * inv_dots[j];
+            if (pn > maxpn)
+                maxpn = pn;
+        }
+        if constexpr (std::is_integral_v<Real>)
+            res[i] = maxpn;
+        else
+            res[i] = static_cast<std::size_t>(maxpn + std::numeric_limits<Real>::epsilon());
+    }
+}
+
+// res[i] = normfn(i-th position), batched when the norm has a batch overload
+template <std::size_t Dim, typename Real, typename NormFn>
+void eval_norms(const NormFn& normfn, const pos_batch<Dim, Real>& poses, std::size_t* res) {
+    if constexpr (std::is_invocable_v<const NormFn&, const pos_batch<Dim, Real>&, std::size_t*>) {
+        normfn(poses, res);
+    } else {
+        for (std::size_t i = 0; i < poses.size(); ++i) {
+            pos_t<Dim> pos;
+            for (std::size_t k = 0; k < Dim; ++k)
+                pos[k] = static_cast<std::int64_t>(poses.coords(k)[i]);
+            res[i] = normfn(pos);
+        }
+    }
+}
+
+} // namespace cgr
@@ -0,0 +1,162 @@
+// Copyright © 2020 Artyom Tokarev. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+#include <cstddef>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <variant>
+#include <stdexcept>
+#include <type_traits>
+#include "cgralgs.h"
+#include "neighborhood.h"
+#include "norm-batch.h"
+
+
+namespace cgr {
+
+// norms as function objects, so the growth path can be instantiated for one of them
+// and call it inline. kind is the neighbourhood kind the norm grows
+
+template <std::size_t Dim>
+struct taxicab_norm {
+    static constexpr nbh::nbhood_kind kind = nbh::nbhood_kind::von_neumann;
+
+    std::size_t operator()(const pos_t<Dim>& pos) const {
+        return norm_taxicab<Dim>(pos);
+    }
+};
+
+template <std::size_t Dim>
+struct chebyshev_norm {
+    static constexpr nbh::nbhood_kind kind = nbh::nbhood_kind::moore;
+
+    std::size_t operator()(const pos_t<Dim>& pos) const {
+        return norm_chebyshev<Dim>(pos);
+    }
+};
+
+template <std::size_t Dim>
+struct euclid_norm {
+    static constexpr nbh::nbhood_kind kind = nbh::nbhood_kind::euclid;
+
+    std::size_t operator()(const pos_t<Dim>& pos) const {
+        return norm_euclid<Dim>(pos);
+    }
+};
+
+// same values as make_norm_cryst_fn()
+template <std::size_t Dim, typename Real = double>
+class cryst_norm {
+public:
+    static constexpr nbh::nbhood_kind kind = nbh::nbhood_kind::crystallographic;
+
+    const std::vector<grow_dir_t<Dim, Real>>& grow_dirs() const {
+        return m_grow_dirs;
+    }
+
+    std::size_t operator()(const pos_t<Dim>& pos) const {
+        auto cpos = static_cast<spt::vec<Dim, Real>>(pos);
+        Real maxpn = 0;
+        for (std::size_t i = 0; i < m_grow_dirs.size(); ++i) {
+            auto pn = std::abs(spt::dot(cpos, m_grow_dirs[i])) * m_inv_dots[i];
+            if (pn > maxpn)
+                maxpn = pn;
+        }
+        if constexpr (std::is_integral_v<Real>)
+            return maxpn;
+        else
+            return static_cast<std::size_t>(maxpn + std::numeric_limits<Real>::epsilon());
+    }
+    void operator()(const pos_batch<Dim, Real>& poses, std::size_t* res) const {
+        norm_cryst_batch<Dim, Real>(m_grow_dirs, m_inv_dots, poses, res);
+    }
+
+    cryst_norm(std::vector<grow_dir_t<Dim, Real>> growdirs) : m_grow_dirs{ std::move(growdirs) } {
+        m_inv_dots.reserve(m_grow_dirs.size());
+        for (auto& gd : m_grow_dirs)
+            m_inv_dots.push_back(static_cast<Real>(1) / spt::dot(gd, gd));
+    }
+
+
+private:
+    std::vector<grow_dir_t<Dim, Real>> m_grow_dirs;
+    std::vector<Real> m_inv_dots;
+};
+
+
+// any of the norms above chosen at runtime, dispatched once per visit
+template <std::size_t Dim, typename Real = double>
+class any_norm {
+public:
+    using variant_type = std::variant<
+        taxicab_norm<Dim>, chebyshev_norm<Dim>, euclid_norm<Dim>, cryst_norm<Dim, Real>>;
+
+    nbh::nbhood_kind kind() const {
+        return visit([](auto& norm) { return norm.kind; });
+    }
+
+    // fn(norm) with the norm of its own type
+    template <typename Fn>
+    decltype(auto) visit(Fn&& fn) const {
+        return std::visit(std::forward<Fn>(fn), m_norm);
+    }
+    std::size_t operator()(const pos_t<Dim>& pos) const {
+        return visit([&pos](auto& norm) { return norm(pos); });
+    }
+    void operator()(const pos_batch<Dim, Real>& poses, std::size_t* res) const {
+        visit([&poses, res](auto& norm) { eval_norms<Dim, Real>(norm, poses, res); });
+    }
+
+    template <typename Norm, typename = std::enable_if_t<!std::is_same_v<std::decay_t<Norm>, any_norm>>>
+    any_norm(Norm norm) : m_norm{ std::move(norm) } {}
+
+
+private:
+    variant_type m_norm;
+};
+
+
+template <typename Norm>
+struct is_any_norm : std::false_type {};
+template <std::size_t Dim, typename Real>
+struct is_any_norm<any_norm<Dim, Real>> : std::true_type {};
+
+// fn(norm) with the concrete norm inside
+template <typename Norm, typename Fn>
+decltype(auto) visit_norm(const Norm& norm, Fn&& fn) {
+    if constexpr (is_any_norm<Norm>::value)
+        return norm.visit(std::forward<Fn>(fn));
+    else
+        return std::forward<Fn>(fn)(norm);
+}
+
+// norm of kind, growdirs are used by the crystallographic one only.
+// a concrete Norm accepts only its own kind
+template <typename Norm, std::size_t Dim, typename Real>
+Norm make_norm(nbh::nbhood_kind kind, const std::vector<grow_dir_t<Dim, Real>>& growdirs) {
+    if constexpr (is_any_norm<Norm>::value) {
+        switch (kind) {
+        case nbh::nbhood_kind::von_neumann:
+            return taxicab_norm<Dim>();
+        case nbh::nbhood_kind::moore:
+            return chebyshev_norm<Dim>();
+        case nbh::nbhood_kind::euclid:
+            return euclid_norm<Dim>();
+        case nbh::nbhood_kind::crystallographic:
+            return cryst_norm<Dim, Real>(growdirs);
+        default:
+            throw std::invalid_argument("cgr::make_norm: unknown nbhood_kind");
+        }
+    } else {
+        if (kind != Norm::kind)
+            throw std::invalid_argument("cgr::make_norm: nbhood_kind does not match the norm");
+        if constexpr (Norm::kind == nbh::nbhood_kind::crystallographic)
+            return Norm(growdirs);
+        else
+            return Norm();
+    }
+}
+
+} // namespace cgr
@@ -0,0 +1,111 @@
+// Copyright © 2020 Artyom Tokarev. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <algorithm>
+#include <functional>
+#include <initializer_list>
+#include <limits>
+
+
+namespace cgr {
+
+// sorted set of at most Capacity unique values stored inline. a full set saturates,
+// it keeps its Capacity smallest values and tells it by saturated(), so the values
+// kept do not depend on the order of insertion. the flag is not a part of the value
+template <typename T, std::size_t Capacity>
+class small_set {
+    static_assert(Capacity > 0 && Capacity <= std::numeric_limits<std::uint8_t>::max());
+
+public:
+    using value_type = T;
+    static constexpr std::size_t capacity = Capacity;
+
+    std::size_t size() const {
+        return m_size;
+    }
+    bool empty() const {
+        return m_size == 0;
+    }
+    // some value was dropped at the capacity
+    bool saturated() const {
+        return m_saturated;
+    }
+
+    const T* begin() const {
+        return m_x.data();
+    }
+    const T* end() const {
+        return m_x.data() + m_size;
+    }
+    const T& front() const {
+        return m_x.front();
+    }
+    const T& operator[](std::size_t idx) const {
+        return m_x[idx];
+    }
+
+    bool contains(const T& val) const {
+        return std::binary_search(begin(), end(), val);
+    }
+    // whether the set has changed
+    bool insert(const T& val) {
+        auto last = m_x.begin() + m_size;
+        auto it = std::lower_bound(m_x.begin(), last, val);
+        if (it != last && *it == val)
+            return false;
+        if (m_size == Capacity) {
+            m_saturated = true;
+            if (it == last)
+                return false;
+            --last;
+            --m_size;
+        }
+
+        std::move_backward(it, last, last + 1);
+        *it = val;
+        ++m_size;
+        return true;
+    }
+    void clear() {
+        m_size = 0;
+        m_saturated = false;
+    }
+
+    bool operator==(const small_set& right) const {
+        return m_size == right.m_size && std::equal(begin(), end(), right.begin());
+    }
+    bool operator!=(const small_set& right) const {
+        return !(*this == right);
+    }
+
+    small_set() = default;
+    small_set(std::initializer_list<T> vals) {
+        for (auto& val : vals)
+            insert(val);
+    }
+
+
+private:
+    std::array<T, Capacity> m_x{};
+    std::uint8_t m_size = 0;
+    bool m_saturated = false;
+};
+
+} // namespace cgr
+
+
+// taken from boost
+template <typename T, std::size_t Capacity>
+struct std::hash<cgr::small_set<T, Capacity>> {
+    std::size_t operator()(const cgr::small_set<T, Capacity>& key) const {
+        std::hash<T> hasher;
+        std::size_t h = key.size();
+        for (auto& e : key)
+            h ^= hasher(e) + 0x9e3779b9 + (h << 6) + (h >> 2);
+        return h;
+    }
+};
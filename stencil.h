@@ -0,0 +1,125 @@
+// Copyright © 2020 Artyom Tokarev. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <tuple>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <type_traits>
+#include "neighborhood.h"
+#include "layout.h"
+#include "norms.h"
+
+
+namespace cgr {
+
+// shifts of a neighbourhood within bbox_range of its center
+// and their linear offset deltas when the layout is linear.
+// Coord and the signed Offset need only hold the bbox and the grid respectively
+template <std::size_t Dim, typename Coord = std::int64_t, typename Offset = std::size_t>
+struct stencil {
+    using delta_type = std::make_signed_t<Offset>;
+
+    std::vector<pos_t<Dim, Coord>> shifts;
+    std::vector<delta_type> deltas;
+    std::size_t bbox_range = 0;
+
+    // unit directions e preceding the center in row-major order, axis ones first,
+    // shells[i] holds the shifts s with s - shell_dirs[i] outside the stencil,
+    // that is the part not covered by the same stencil centered at shell_dirs[i]
+    std::vector<pos_t<Dim, Coord>> shell_dirs;
+    std::vector<delta_type> shell_dir_deltas;
+    std::vector<stencil> shells;
+};
+
+// stencils shared by the grains growing by the same norm with the same range
+template <std::size_t Dim, typename Real = double, typename Layout = linear_layout<Dim>,
+          typename Coord = std::int64_t, typename Offset = std::size_t>
+class stencil_cache {
+public:
+    using stencil_type = stencil<Dim, Coord, Offset>;
+    // norm kind, coordinates of the oriented grow directions (crystallographic only),
+    // range and bbox range
+    using key_type = std::tuple<nbh::nbhood_kind, std::vector<Real>, std::size_t, std::size_t>;
+
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stencils.size();
+    }
+
+    // normfn is used only when the stencil is made
+    template <typename NormFn>
+    std::shared_ptr<const stencil_type> get(const key_type& key, const NormFn& normfn) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto& res = m_stencils[key];
+        if (!res) {
+            auto st = std::make_shared<stencil_type>();
+            st->bbox_range = std::get<3>(key);
+            st->shifts = nbh::make_shifts<Dim, NormFn, Coord>(normfn, std::get<2>(key), st->bbox_range);
+            if constexpr (Layout::is_linear)
+                st->deltas = nbh::shifts_to_deltas<Dim, Coord, typename stencil_type::delta_type>(
+                    st->shifts, m_dim_lens);
+            make_shells(*st);
+            res = std::move(st);
+        }
+        return res;
+    }
+
+    stencil_cache(const upos_t<Dim>& dimlens) : m_dim_lens{ dimlens } {}
+
+
+private:
+    using delta_type = typename stencil_type::delta_type;
+
+    upos_t<Dim> m_dim_lens;
+    std::map<key_type, std::shared_ptr<const stencil_type>> m_stencils;
+    mutable std::mutex m_mutex;
+
+    void make_shells(stencil_type& st) const {
+        using shift_type = pos_t<Dim, Coord>;
+        std::vector<shift_type> sorted = st.shifts;
+        sorted.push_back(shift_type());
+        std::sort(sorted.begin(), sorted.end());
+
+        // the last nonzero component of a preceding direction is negative
+        std::vector<shift_type> dirs;
+        for (auto& sh : nbh::make_shifts<Dim, chebyshev_norm<Dim>, Coord>(chebyshev_norm<Dim>(), 1)) {
+            std::size_t k = Dim;
+            while (sh[k - 1] == 0)
+                --k;
+            if (sh[k - 1] < 0)
+                dirs.push_back(sh);
+        }
+        auto num_nonzero = [](const shift_type& sh) {
+            return std::count_if(sh.x.begin(), sh.x.end(), [](Coord e) { return e != 0; });
+        };
+        std::stable_sort(dirs.begin(), dirs.end(),
+            [&num_nonzero](const shift_type& l, const shift_type& r) {
+                return num_nonzero(l) < num_nonzero(r);
+            });
+
+        for (auto& dir : dirs) {
+            stencil_type shell;
+            shell.bbox_range = st.bbox_range;
+            for (std::size_t i = 0; i < st.shifts.size(); ++i) {
+                if (std::binary_search(sorted.begin(), sorted.end(), st.shifts[i] - dir))
+                    continue;
+                shell.shifts.push_back(st.shifts[i]);
+                if constexpr (Layout::is_linear)
+                    shell.deltas.push_back(st.deltas[i]);
+            }
+            st.shell_dirs.push_back(dir);
+            if constexpr (Layout::is_linear)
+                st.shell_dir_deltas.push_back(static_cast<delta_type>(
+                    cgr::offset(static_cast<pos_t<Dim>>(dir), m_dim_lens)));
+            st.shells.push_back(std::move(shell));
+        }
+    }
+};
+
+} // namespace cgr
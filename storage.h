@@ -0,0 +1,288 @@
+// Copyright © 2020 Artyom Tokarev. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+#include <system_error>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+
+namespace cgr {
+
+// how an array is about to be accessed, a hint for the paging of mapped arrays
+enum class access_pattern {
+    normal,
+    sequential,
+    random
+};
+
+
+// array of trivially copyable T in a temporary file mapped into memory,
+// the file is removed once it is closed. pages are read and written back by the OS,
+// so the array may be larger than the physical memory
+template <typename T>
+class mapped_array {
+    static_assert(std::is_trivially_copyable_v<T>);
+
+public:
+    using value_type = T;
+
+    std::size_t size() const {
+        return m_size;
+    }
+    T* data() {
+        return m_data;
+    }
+    const T* data() const {
+        return m_data;
+    }
+    T& operator[](std::size_t i) {
+        return m_data[i];
+    }
+    const T& operator[](std::size_t i) const {
+        return m_data[i];
+    }
+    T* begin() {
+        return m_data;
+    }
+    T* end() {
+        return m_data + m_size;
+    }
+    const T* begin() const {
+        return m_data;
+    }
+    const T* end() const {
+        return m_data + m_size;
+    }
+
+    // madvise() on POSIX, there is no such hint on Win32
+    void advise(access_pattern access) const {
+        if (m_size == 0 || access == m_access)
+            return;
+        m_access = access;
+#if !defined(_WIN32)
+        int advice = MADV_NORMAL;
+        if (access == access_pattern::sequential)
+            advice = MADV_SEQUENTIAL;
+        else if (access == access_pattern::random)
+            advice = MADV_RANDOM;
+        ::madvise(m_data, num_bytes(), advice);
+#endif
+    }
+
+    // bytes of the array in the physical memory
+    std::size_t resident_bytes() const {
+        if (m_size == 0)
+            return 0;
+        std::size_t page = page_size();
+        std::size_t num_pages = (num_bytes() + page - 1) / page;
+        std::size_t num_resident = 0;
+#if defined(_WIN32)
+        constexpr std::size_t batch = 1 << 16;
+        std::vector<PSAPI_WORKING_SET_EX_INFORMATION> infos(std::min(batch, num_pages));
+        for (std::size_t first = 0; first < num_pages; first += batch) {
+            std::size_t n = std::min(batch, num_pages - first);
+            for (std::size_t i = 0; i < n; ++i)
+                infos[i].VirtualAddress = reinterpret_cast<char*>(m_data) + (first + i) * page;
+            if (!QueryWorkingSetEx(GetCurrentProcess(), infos.data(),
+                                   static_cast<DWORD>(n * sizeof(PSAPI_WORKING_SET_EX_INFORMATION))))
+                throw std::system_error(GetLastError(), std::system_category(), "cgr::mapped_array: QueryWorkingSetEx");
+            for (std::size_t i = 0; i < n; ++i)
+                num_resident += infos[i].VirtualAttributes.Valid;
+        }
+#else
+        std::vector<unsigned char> resident(num_pages);
+        if (::mincore(m_data, num_bytes(), resident.data()) != 0)
+            throw std::system_error(errno, std::generic_category(), "cgr::mapped_array: mincore");
+        for (auto r : resident)
+            num_resident += r & 1;
+#endif
+        return std::min(num_resident * page, num_bytes());
+    }
+
+    void swap(mapped_array& other) noexcept {
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+        std::swap(m_access, other.m_access);
+#if defined(_WIN32)
+        std::swap(m_file, other.m_file);
+        std::swap(m_mapping, other.m_mapping);
+#endif
+    }
+
+    mapped_array() = default;
+    // n copies of value in a new file in dir
+    mapped_array(const std::string& dir, std::size_t n, const T& value) : m_size{ n } {
+        if (m_size == 0)
+            return;
+        map(dir);
+        bool zero = true;
+        for (std::size_t i = 0; i < sizeof(T); ++i)
+            zero &= reinterpret_cast<const unsigned char*>(&value)[i] == 0;
+        // the file is created filled with zeros
+        if (!zero) {
+            #pragma omp parallel for
+            for (std::int64_t i = 0; i < static_cast<std::int64_t>(m_size); ++i)
+                m_data[i] = value;
+        }
+    }
+    mapped_array(const mapped_array&) = delete;
+    mapped_array& operator=(const mapped_array&) = delete;
+    mapped_array(mapped_array&& other) noexcept {
+        swap(other);
+    }
+    mapped_array& operator=(mapped_array&& other) noexcept {
+        mapped_array tmp(std::move(other));
+        swap(tmp);
+        return *this;
+    }
+    ~mapped_array() {
+        unmap();
+    }
+
+
+private:
+    T* m_data = nullptr;
+    std::size_t m_size = 0;
+    mutable access_pattern m_access = access_pattern::normal;
+#if defined(_WIN32)
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+#endif
+
+    std::size_t num_bytes() const {
+        return m_size * sizeof(T);
+    }
+
+    static std::size_t page_size() {
+#if defined(_WIN32)
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwPageSize;
+#else
+        return static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+#endif
+    }
+
+    void map(const std::string& dir) {
+        std::size_t bytes = num_bytes();
+#if defined(_WIN32)
+        char path[MAX_PATH];
+        if (!GetTempFileNameA(dir.c_str(), "cgr", 0, path))
+            throw std::system_error(GetLastError(), std::system_category(), "cgr::mapped_array: GetTempFileName");
+        m_file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                             FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE)
+            throw std::system_error(GetLastError(), std::system_category(), "cgr::mapped_array: CreateFile");
+        auto size = static_cast<std::uint64_t>(bytes);
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE,
+                                       static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+        if (!m_mapping) {
+            auto err = GetLastError();
+            unmap();
+            throw std::system_error(err, std::system_category(), "cgr::mapped_array: CreateFileMapping");
+        }
+        m_data = static_cast<T*>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes));
+        if (!m_data) {
+            auto err = GetLastError();
+            unmap();
+            throw std::system_error(err, std::system_category(), "cgr::mapped_array: MapViewOfFile");
+        }
+#else
+        std::string path = dir + "/crygrow-XXXXXX";
+        int fd = ::mkstemp(&path[0]);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "cgr::mapped_array: mkstemp");
+        // the name is not needed, the file lives while it is mapped
+        ::unlink(path.c_str());
+        if (::ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "cgr::mapped_array: ftruncate");
+        }
+        void* addr = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        int err = errno;
+        ::close(fd);
+        if (addr == MAP_FAILED)
+            throw std::system_error(err, std::generic_category(), "cgr::mapped_array: mmap");
+        m_data = static_cast<T*>(addr);
+#endif
+    }
+
+    void unmap() {
+#if defined(_WIN32)
+        if (m_data)
+            UnmapViewOfFile(m_data);
+        if (m_mapping)
+            CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE)
+            CloseHandle(m_file);
+        m_mapping = nullptr;
+        m_file = INVALID_HANDLE_VALUE;
+#else
+        if (m_data)
+            ::munmap(m_data, num_bytes());
+#endif
+        m_data = nullptr;
+    }
+};
+
+
+// storages make the per cell arrays of automata
+
+// arrays in the memory of the process
+struct vector_storage {
+    template <typename T>
+    using array = std::vector<T>;
+
+    template <typename T>
+    array<T> make(std::size_t n, const T& value) const {
+        return array<T>(n, value);
+    }
+    template <typename T>
+    void advise(const array<T>&, access_pattern) const {}
+    template <typename T>
+    std::size_t resident_bytes(const array<T>& arr) const {
+        return arr.size() * sizeof(T);
+    }
+};
+
+// arrays in temporary files in a directory, for grids larger than the memory
+struct mapped_storage {
+    template <typename T>
+    using array = mapped_array<T>;
+
+    std::string dir = ".";
+
+    template <typename T>
+    array<T> make(std::size_t n, const T& value) const {
+        return array<T>(dir, n, value);
+    }
+    template <typename T>
+    void advise(const array<T>& arr, access_pattern access) const {
+        arr.advise(access);
+    }
+    template <typename T>
+    std::size_t resident_bytes(const array<T>& arr) const {
+        return arr.resident_bytes();
+    }
+};
+
+} // namespace cgr
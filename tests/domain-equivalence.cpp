@@ -0,0 +1,161 @@
+// Copyright © 2020 Artyom Tokarev. All rights reserved.
+// Licensed under the MIT License.
+
+// domain_automata on local ranks against one automata, cell for cell, for every
+// neighbourhood, front engine and layout, and a throwing overflow hook stopping every rank.
+// g++ -std=c++17 -O2 -fopenmp -I.. domain-equivalence.cpp -o domain-equivalence
+#include <iostream>
+#include <random>
+#include <mutex>
+#include <array>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include "../sptalgs.h"
+#include "../automata.h"
+#include "../domain.h"
+
+
+namespace {
+
+constexpr std::size_t dim = 3;
+constexpr std::size_t size = 24;
+constexpr std::size_t range = 2;
+constexpr std::size_t num_grains = 8;
+constexpr std::size_t max_ranks = 4;
+
+using grain_t = cgr::grain<dim>;
+using material_t = cgr::material<dim>;
+
+const std::array<cgr::nbh::nbhood_kind, 4> kinds{
+    cgr::nbh::nbhood_kind::crystallographic, cgr::nbh::nbhood_kind::euclid,
+    cgr::nbh::nbhood_kind::moore, cgr::nbh::nbhood_kind::von_neumann };
+const std::array<cgr::front_engine, 3> engines{
+    cgr::front_engine::stencil, cgr::front_engine::shell, cgr::front_engine::bitset };
+
+struct sample {
+    material_t mater;
+    std::vector<grain_t> grains;
+    std::vector<cgr::upos_t<dim>> poses;
+
+    sample() : mater({ spt::vecd<dim>({ 1.0, 0.0, 0.0 }), spt::vecd<dim>({ 0.0, 1.0, 0.0 }),
+                       spt::vecd<dim>({ 0.0, 0.0, 1.0 }) }) {
+        std::mt19937_64 gen(7);
+        std::uniform_real_distribution<double> dis(-1.0, 1.0);
+        std::uniform_int_distribution<std::size_t> posdis(0, size - 1);
+        grains.reserve(num_grains);
+        for (std::size_t i = 0; i < num_grains; ++i) {
+            auto rot = spt::rotation(spt::vecd<dim>({ dis(gen), dis(gen), dis(gen) }).normalize(), std::abs(dis(gen)) * 3.14159);
+            grains.emplace_back(&mater, rot);
+            cgr::upos_t<dim> pos;
+            for (auto& e : pos.x)
+                e = posdis(gen);
+            poses.push_back(pos);
+        }
+    }
+};
+
+// grains of the cell as their indices, "-" for an empty one
+template <typename Cell>
+std::string cell_key(const Cell* cell, const grain_t* first) {
+    if (!cell)
+        return "-";
+    std::vector<std::ptrdiff_t> idxs;
+    for (auto gr : cell->grains)
+        idxs.push_back(gr - first);
+    std::sort(idxs.begin(), idxs.end());
+    std::string res;
+    for (auto idx : idxs)
+        res += std::to_string(idx) + ",";
+    return res;
+}
+
+// every grain by a neighbourhood of its own, so each run takes all of them
+cgr::nbh::nbhood_kind grain_kind(std::size_t i) {
+    return kinds[i % kinds.size()];
+}
+
+// cells differing from the serial run, the count of overflowed cells is one more
+template <typename Automata>
+std::size_t num_mismatches(const sample& smp, cgr::front_engine engine, std::size_t num_ranks) {
+    Automata serial(size);
+    serial.set_range(range);
+    serial.set_engine(engine);
+    for (std::size_t i = 0; i < num_grains; ++i)
+        serial.spawn_grain(&smp.grains[i], smp.poses[i], grain_kind(i));
+    while (serial.iterate());
+
+    std::size_t res = 0;
+    std::size_t num_checked = 0;
+    std::mutex mutex;
+    cgr::run_local_ranks(num_ranks, [&](cgr::local_transport& transport) {
+        cgr::domain_automata<Automata, cgr::local_transport> dom(
+            cgr::upos_t<dim>::filled_with(size), range, transport);
+        dom.set_engine(engine);
+        for (std::size_t i = 0; i < num_grains; ++i)
+            dom.spawn_grain(&smp.grains[i], smp.poses[i], grain_kind(i));
+        while (dom.iterate());
+        bool overflowed_same = dom.num_overflowed_cells() == serial.num_overflowed_cells();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        res += !overflowed_same;
+        for (std::size_t i = 0; i < serial.num_cells(); ++i) {
+            auto pos = cgr::upos(i, serial.dim_lens());
+            if (!dom.owns(pos))
+                continue;
+            ++num_checked;
+            res += cell_key(dom.cell(pos), smp.grains.data()) != cell_key(serial.cell(pos), smp.grains.data());
+        }
+    });
+    if (num_checked != serial.num_cells())
+        throw std::logic_error("cells not owned by exactly one rank");
+    return res;
+}
+
+// a hook throwing on one rank only would leave the others waiting
+template <typename Automata>
+bool hook_stops_every_rank(const sample& smp, std::size_t num_ranks) {
+    try {
+        cgr::run_local_ranks(num_ranks, [&](cgr::local_transport& transport) {
+            cgr::domain_automata<Automata, cgr::local_transport> dom(
+                cgr::upos_t<dim>::filled_with(size), range, transport);
+            dom.set_overflow_hook([](const auto&) {
+                throw std::runtime_error("overflowed");
+            });
+            for (std::size_t i = 0; i < num_grains; ++i)
+                dom.spawn_grain(&smp.grains[i], smp.poses[i], grain_kind(i));
+            while (dom.iterate());
+        });
+    } catch (const std::runtime_error& e) {
+        return e.what() == std::string("overflowed");
+    }
+    return false;
+}
+
+template <typename Automata>
+bool check_layout(const sample& smp, const std::string& name) {
+    bool res = true;
+    for (auto engine : engines) {
+        for (std::size_t num_ranks = 1; num_ranks <= max_ranks; ++num_ranks) {
+            std::size_t mismatches = num_mismatches<Automata>(smp, engine, num_ranks);
+            std::cout << name << " engine " << static_cast<int>(engine) << " ranks " << num_ranks
+                      << ": " << mismatches << " mismatches" << std::endl;
+            res &= mismatches == 0;
+        }
+    }
+    bool stopped = hook_stops_every_rank<Automata>(smp, max_ranks);
+    std::cout << name << " overflow hook: " << (stopped ? "stopped" : "not called") << std::endl;
+    return res && stopped;
+}
+
+} // namespace
+
+
+int main() {
+    sample smp;
+    bool ok = check_layout<cgr::automata<dim>>(smp, "linear");
+    ok &= check_layout<cgr::automata<dim, double, std::uint32_t, cgr::brick_layout<dim>>>(smp, "brick");
+    std::cout << (ok ? "passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
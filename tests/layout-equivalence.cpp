@@ -0,0 +1,150 @@
+// Copyright © 2020 Artyom Tokarev. All rights reserved.
+// Licensed under the MIT License.
+
+// automata of linear_layout against the same automata of brick_layout, cell for cell,
+// after growth, smooth(), thin_boundary() and voronoi_edt() for every front engine and several
+// seeds. the layout is a storage order only, so none of them may tell the two apart.
+// g++ -std=c++17 -O2 -fopenmp -I.. layout-equivalence.cpp -o layout-equivalence
+#include <iostream>
+#include <random>
+#include <array>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "../sptalgs.h"
+#include "../automata.h"
+
+
+namespace {
+
+constexpr std::size_t dim = 3;
+// not a multiple of the brick side, so the last bricks are padded
+constexpr std::size_t size = 26;
+constexpr std::size_t range = 3;
+constexpr std::size_t num_grains = 12;
+constexpr std::size_t num_seeds = 5;
+
+using grain_t = cgr::grain<dim>;
+using material_t = cgr::material<dim>;
+using linear_automata = cgr::automata<dim>;
+using brick_automata = cgr::automata<dim, double, std::uint32_t, cgr::brick_layout<dim>>;
+
+const std::array<cgr::front_engine, 3> engines{
+    cgr::front_engine::stencil, cgr::front_engine::shell, cgr::front_engine::bitset };
+
+struct sample {
+    material_t mater;
+    std::vector<grain_t> grains;
+    std::vector<cgr::upos_t<dim>> poses;
+
+    sample(std::uint64_t seed)
+        : mater({ spt::vecd<dim>({ 1.0, 0.0, 0.0 }), spt::vecd<dim>({ 0.0, 1.0, 0.0 }),
+                  spt::vecd<dim>({ 0.0, 0.0, 1.0 }) }) {
+        std::mt19937_64 gen(seed);
+        std::uniform_real_distribution<double> dis(-1.0, 1.0);
+        std::uniform_int_distribution<std::size_t> posdis(0, size - 1);
+        grains.reserve(num_grains);
+        for (std::size_t i = 0; i < num_grains; ++i) {
+            auto rot = spt::rotation(spt::vecd<dim>({ dis(gen), dis(gen), dis(gen) }).normalize(), std::abs(dis(gen)) * 3.14159);
+            grains.emplace_back(&mater, rot);
+            cgr::upos_t<dim> pos;
+            for (auto& e : pos.x)
+                e = posdis(gen);
+            poses.push_back(pos);
+        }
+    }
+};
+
+// grains of every cell in row-major order as their indices, "-" for an empty one
+template <typename Automata>
+std::string grid_key(const Automata& atmt, const grain_t* first) {
+    std::string res;
+    for (std::size_t i = 0; i < atmt.num_cells(); ++i) {
+        auto cell = atmt.cell(cgr::upos(i, atmt.dim_lens()));
+        if (!cell) {
+            res += "-;";
+            continue;
+        }
+        std::vector<std::ptrdiff_t> idxs;
+        for (auto gr : cell->grains)
+            idxs.push_back(gr - first);
+        std::sort(idxs.begin(), idxs.end());
+        for (auto idx : idxs)
+            res += std::to_string(idx) + ",";
+        res += ";";
+    }
+    return res;
+}
+
+template <typename Automata>
+void grow(Automata& atmt, const sample& smp, cgr::front_engine engine) {
+    atmt.set_range(range);
+    atmt.set_engine(engine);
+    for (std::size_t i = 0; i < num_grains; ++i)
+        atmt.spawn_grain(&smp.grains[i], smp.poses[i], cgr::nbh::nbhood_kind::crystallographic);
+    while (atmt.iterate());
+}
+
+template <typename Automata>
+std::string grown_key(const sample& smp, cgr::front_engine engine) {
+    Automata atmt(size);
+    grow(atmt, smp, engine);
+    return grid_key(atmt, smp.grains.data());
+}
+
+template <typename Automata>
+std::string smoothed_key(const sample& smp, cgr::front_engine engine) {
+    Automata atmt(size);
+    grow(atmt, smp, engine);
+    atmt.smooth(1);
+    return grid_key(atmt, smp.grains.data());
+}
+
+// labels are interned in storage order, so thin_boundary must not decide by them
+template <typename Automata>
+std::string thinned_key(const sample& smp, cgr::front_engine engine) {
+    Automata atmt(size);
+    grow(atmt, smp, engine);
+    atmt.thin_boundary(1, 1);
+    return grid_key(atmt, smp.grains.data());
+}
+
+// the nuclei only, the rest of the grid is taken by voronoi_edt
+template <typename Automata>
+std::string voronoi_key(const sample& smp) {
+    Automata atmt(size);
+    for (std::size_t i = 0; i < num_grains; ++i)
+        atmt.spawn_grain(&smp.grains[i], smp.poses[i], cgr::nbh::nbhood_kind::euclid);
+    atmt.voronoi_edt();
+    atmt.smooth(1);
+    return grid_key(atmt, smp.grains.data());
+}
+
+bool check(const std::string& name, const std::string& linear_key, const std::string& brick_key) {
+    bool same = linear_key == brick_key;
+    std::cout << name << ": " << (same ? "same" : "differ") << std::endl;
+    return same;
+}
+
+} // namespace
+
+
+int main() {
+    bool ok = true;
+    for (std::uint64_t seed = 1; seed <= num_seeds; ++seed) {
+        sample smp(seed);
+        for (auto engine : engines) {
+            std::string name = "seed " + std::to_string(seed) + " engine " + std::to_string(static_cast<int>(engine));
+            ok &= check(name + " growth",
+                grown_key<linear_automata>(smp, engine), grown_key<brick_automata>(smp, engine));
+            ok &= check(name + " smooth",
+                smoothed_key<linear_automata>(smp, engine), smoothed_key<brick_automata>(smp, engine));
+            ok &= check(name + " thin_boundary",
+                thinned_key<linear_automata>(smp, engine), thinned_key<brick_automata>(smp, engine));
+        }
+        ok &= check("seed " + std::to_string(seed) + " voronoi_edt",
+            voronoi_key<linear_automata>(smp), voronoi_key<brick_automata>(smp));
+    }
+    std::cout << (ok ? "passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
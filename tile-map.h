@@ -0,0 +1,152 @@
+// Copyright © 2020 Artyom Tokarev. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "cgralgs.h"
+
+
+namespace cgr {
+
+// the grid cut into cubic tiles of 2^SideLog2 cells per side in position space,
+// tiles are numbered in row-major order. a tile is uniform when all its cells
+// hold one label, a dirty one has its cells changed since it was last refreshed
+template <std::size_t Dim, typename Label, std::size_t SideLog2 = 3>
+class tile_map {
+public:
+    static constexpr std::size_t tile_side = static_cast<std::size_t>(1) << SideLog2;
+
+    std::size_t num_tiles() const {
+        return m_uniform.size();
+    }
+    const upos_t<Dim>& tile_dims() const {
+        return m_tile_dims;
+    }
+
+    bool uniform(std::size_t t) const {
+        return m_uniform[t];
+    }
+    // of a uniform tile
+    Label label(std::size_t t) const {
+        return m_labels[t];
+    }
+    bool dirty(std::size_t t) const {
+        return m_dirty[t];
+    }
+
+    std::size_t tile_of(const upos_t<Dim>& pos) const {
+        std::size_t res = 0;
+        for (std::size_t i = Dim; i-- > 0;)
+            res = res * m_tile_dims[i] + (pos[i] >> SideLog2);
+        return res;
+    }
+    upos_t<Dim> tile_pos(std::size_t t) const {
+        return cgr::upos(t, m_tile_dims);
+    }
+    // first and last cells of tile t
+    upos_t<Dim> min_corner(std::size_t t) const {
+        auto res = tile_pos(t);
+        for (std::size_t i = 0; i < Dim; ++i)
+            res[i] <<= SideLog2;
+        return res;
+    }
+    upos_t<Dim> max_corner(std::size_t t) const {
+        auto res = tile_pos(t);
+        for (std::size_t i = 0; i < Dim; ++i)
+            res[i] = std::min((res[i] + 1) << SideLog2, m_dim_lens[i]) - 1;
+        return res;
+    }
+
+    // fn(t) for the tiles within ring tiles of tile t along every axis, t included,
+    // until it returns false
+    template <typename Fn>
+    bool all_of_ring(std::size_t t, std::size_t ring, Fn fn) const {
+        auto tpos = static_cast<pos_t<Dim>>(tile_pos(t));
+        std::int64_t sring = ring;
+        pos_t<Dim> lo, hi;
+        for (std::size_t i = 0; i < Dim; ++i) {
+            lo[i] = std::max<std::int64_t>(tpos[i] - sring, 0);
+            hi[i] = std::min<std::int64_t>(tpos[i] + sring, m_tile_dims[i] - 1);
+        }
+        pos_t<Dim> p = lo;
+        while (true) {
+            if (!fn(tile_of_tile_pos(p)))
+                return false;
+            std::size_t i = 0;
+            for (; i < Dim && ++p[i] > hi[i]; ++i)
+                p[i] = lo[i];
+            if (i == Dim)
+                return true;
+        }
+    }
+
+    // tiles intersecting the box of cells [lo, hi]
+    void mark_dirty(const upos_t<Dim>& lo, const upos_t<Dim>& hi) {
+        pos_t<Dim> tlo, thi;
+        for (std::size_t i = 0; i < Dim; ++i) {
+            tlo[i] = lo[i] >> SideLog2;
+            thi[i] = hi[i] >> SideLog2;
+        }
+        pos_t<Dim> p = tlo;
+        while (true) {
+            m_dirty[tile_of_tile_pos(p)] = 1;
+            std::size_t i = 0;
+            for (; i < Dim && ++p[i] > thi[i]; ++i)
+                p[i] = tlo[i];
+            if (i == Dim)
+                return;
+        }
+    }
+    void mark_dirty(std::size_t t) {
+        m_dirty[t] = 1;
+    }
+    void mark_all_dirty() {
+        std::fill(m_dirty.begin(), m_dirty.end(), 1);
+    }
+
+    // every dirty tile t is told uniform_label(t), it returns whether
+    // the tile is uniform and its label then, dirty tiles are refreshed in parallel
+    template <typename UniformFn>
+    void refresh(UniformFn uniform_label) {
+        #pragma omp parallel for schedule(dynamic, 16)
+        for (std::int64_t t = 0; t < static_cast<std::int64_t>(num_tiles()); ++t) {
+            if (!m_dirty[t])
+                continue;
+            Label lbl;
+            m_uniform[t] = uniform_label(t, lbl);
+            m_labels[t] = lbl;
+            m_dirty[t] = 0;
+        }
+    }
+
+    tile_map(const upos_t<Dim>& dimlens) : m_dim_lens{ dimlens } {
+        std::size_t num_tiles = 1;
+        for (std::size_t i = 0; i < Dim; ++i) {
+            m_tile_dims[i] = (dimlens[i] + tile_side - 1) >> SideLog2;
+            num_tiles *= m_tile_dims[i];
+        }
+        m_uniform.assign(num_tiles, 0);
+        m_labels.assign(num_tiles, Label());
+        m_dirty.assign(num_tiles, 1);
+    }
+
+
+private:
+    upos_t<Dim> m_dim_lens;
+    upos_t<Dim> m_tile_dims;
+    std::vector<std::uint8_t> m_uniform;
+    std::vector<Label> m_labels;
+    std::vector<std::uint8_t> m_dirty;
+
+    std::size_t tile_of_tile_pos(const pos_t<Dim>& p) const {
+        std::size_t res = 0;
+        for (std::size_t i = Dim; i-- > 0;)
+            res = res * m_tile_dims[i] + p[i];
+        return res;
+    }
+};
+
+} // namespace cgr
@@ -0,0 +1,254 @@
+// Copyright © 2020 Artyom Tokarev. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+#include <vector>
+#include <deque>
+#include <list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
+#include <type_traits>
+#if defined(CGR_MPI)
+#include <mpi.h>
+#endif
+
+
+namespace cgr {
+
+// a transport connects the ranks of a decomposed run:
+//   std::size_t rank() const, std::size_t size() const,
+//   void send(std::size_t dest, std::vector<char> msg), does not wait for the receiver,
+//   std::vector<char> recv(std::size_t src), messages of a pair of ranks keep their order,
+//   std::uint64_t sum(std::uint64_t val), val summed over the ranks, every rank calls it
+
+// values packed into a message in the byte order of the machine
+class byte_writer {
+public:
+    std::vector<char> take() {
+        return std::move(m_bytes);
+    }
+
+    template <typename T>
+    void put(const T& val) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        auto bytes = reinterpret_cast<const char*>(&val);
+        m_bytes.insert(m_bytes.end(), bytes, bytes + sizeof(T));
+    }
+
+
+private:
+    std::vector<char> m_bytes;
+};
+
+class byte_reader {
+public:
+    bool done() const {
+        return m_pos == m_bytes.size();
+    }
+
+    template <typename T>
+    T get() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (m_bytes.size() - m_pos < sizeof(T))
+            throw std::runtime_error("cgr::byte_reader: message too short");
+        T res;
+        std::memcpy(&res, m_bytes.data() + m_pos, sizeof(T));
+        m_pos += sizeof(T);
+        return res;
+    }
+
+    byte_reader(const std::vector<char>& bytes) : m_bytes{ bytes } {}
+
+
+private:
+    const std::vector<char>& m_bytes;
+    std::size_t m_pos = 0;
+};
+
+
+// mailboxes and the sum of the ranks running as threads of one process
+class local_hub {
+public:
+    std::size_t size() const {
+        return m_size;
+    }
+
+    void send(std::size_t src, std::size_t dest, std::vector<char> msg) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_boxes[src * m_size + dest].push_back(std::move(msg));
+        }
+        m_cond.notify_all();
+    }
+    std::vector<char> recv(std::size_t src, std::size_t dest) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto& box = m_boxes[src * m_size + dest];
+        m_cond.wait(lock, [&box] { return !box.empty(); });
+        auto res = std::move(box.front());
+        box.pop_front();
+        return res;
+    }
+
+    // the last rank to arrive publishes the sum, the next round cannot
+    // overwrite it before every rank has taken it
+    std::uint64_t sum(std::uint64_t val) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_acc += val;
+        if (++m_arrived == m_size) {
+            m_sum = m_acc;
+            m_acc = 0;
+            m_arrived = 0;
+            ++m_round;
+            m_cond.notify_all();
+        } else {
+            std::size_t round = m_round;
+            m_cond.wait(lock, [this, round] { return m_round != round; });
+        }
+        return m_sum;
+    }
+
+    local_hub(std::size_t size) : m_size{ size }, m_boxes(size * size) {}
+
+
+private:
+    std::size_t m_size;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    // indexed by src * size + dest
+    std::vector<std::deque<std::vector<char>>> m_boxes;
+    std::uint64_t m_acc = 0;
+    std::uint64_t m_sum = 0;
+    std::size_t m_arrived = 0;
+    std::size_t m_round = 0;
+};
+
+// a rank of a local_hub
+class local_transport {
+public:
+    std::size_t rank() const {
+        return m_rank;
+    }
+    std::size_t size() const {
+        return m_hub->size();
+    }
+
+    void send(std::size_t dest, std::vector<char> msg) {
+        m_hub->send(m_rank, dest, std::move(msg));
+    }
+    std::vector<char> recv(std::size_t src) {
+        return m_hub->recv(src, m_rank);
+    }
+    std::uint64_t sum(std::uint64_t val) {
+        return m_hub->sum(val);
+    }
+
+    local_transport(local_hub& hub, std::size_t rank) : m_hub{ &hub }, m_rank{ rank } {}
+
+
+private:
+    local_hub* m_hub;
+    std::size_t m_rank;
+};
+
+// fn(transport) for every rank on a thread of its own, the exception of the lowest
+// rank throwing is rethrown. a rank throwing leaves the others waiting on it,
+// so fn must not throw in the middle of a collective step
+template <typename Fn>
+void run_local_ranks(std::size_t num_ranks, Fn fn) {
+    local_hub hub(num_ranks);
+    std::vector<std::exception_ptr> errors(num_ranks);
+    std::vector<std::thread> threads;
+    threads.reserve(num_ranks);
+    for (std::size_t r = 0; r < num_ranks; ++r)
+        threads.emplace_back([&hub, &errors, &fn, r] {
+            try {
+                local_transport transport(hub, r);
+                fn(transport);
+            } catch (...) {
+                errors[r] = std::current_exception();
+            }
+        });
+    for (auto& th : threads)
+        th.join();
+    for (auto& err : errors)
+        if (err)
+            std::rethrow_exception(err);
+}
+
+
+#if defined(CGR_MPI)
+// ranks of an MPI communicator, sends are nonblocking and complete by the next sum()
+class mpi_transport {
+public:
+    std::size_t rank() const {
+        int res;
+        MPI_Comm_rank(m_comm, &res);
+        return res;
+    }
+    std::size_t size() const {
+        int res;
+        MPI_Comm_size(m_comm, &res);
+        return res;
+    }
+
+    void send(std::size_t dest, std::vector<char> msg) {
+        if (msg.size() > INT_MAX)
+            throw std::length_error("cgr::mpi_transport: message too long");
+        m_pending.emplace_back();
+        auto& p = m_pending.back();
+        p.bytes = std::move(msg);
+        MPI_Isend(p.bytes.data(), static_cast<int>(p.bytes.size()), MPI_CHAR,
+                  static_cast<int>(dest), tag, m_comm, &p.request);
+    }
+    std::vector<char> recv(std::size_t src) {
+        MPI_Status status;
+        MPI_Probe(static_cast<int>(src), tag, m_comm, &status);
+        int count;
+        MPI_Get_count(&status, MPI_CHAR, &count);
+        std::vector<char> res(count);
+        MPI_Recv(res.data(), count, MPI_CHAR, static_cast<int>(src), tag, m_comm, MPI_STATUS_IGNORE);
+        return res;
+    }
+    std::uint64_t sum(std::uint64_t val) {
+        std::uint64_t res;
+        MPI_Allreduce(&val, &res, 1, MPI_UINT64_T, MPI_SUM, m_comm);
+        wait_sends();
+        return res;
+    }
+
+    mpi_transport(MPI_Comm comm = MPI_COMM_WORLD) : m_comm{ comm } {}
+    mpi_transport(const mpi_transport&) = delete;
+    mpi_transport(mpi_transport&&) = default;
+    ~mpi_transport() {
+        wait_sends();
+    }
+
+
+private:
+    static constexpr int tag = 0x6367;
+
+    struct pending_send {
+        MPI_Request request;
+        std::vector<char> bytes;
+    };
+
+    MPI_Comm m_comm;
+    // the list keeps the requests and buffers in place
+    std::list<pending_send> m_pending;
+
+    void wait_sends() {
+        for (auto& p : m_pending)
+            MPI_Wait(&p.request, MPI_STATUS_IGNORE);
+        m_pending.clear();
+    }
+};
+#endif
+
+} // namespace cgr